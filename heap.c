@@ -14,8 +14,24 @@
 //=======
 
 #include <assert.h>
+#include <string.h>
 #include "heap.h"
 
+#if HEAP_LARGE_THRESHOLD||defined(__unix__)
+#include <sys/mman.h>
+#endif
+
+#if HEAP_THREADSAFE
+#include <time.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#else
+#include <sched.h>
+#endif
+#endif
+
 
 //======
 // Heap
@@ -25,9 +41,7 @@ void* heap_alloc(heap_t* heap, size_t size)
 {
 assert(heap!=nullptr);
 assert(size!=0);
-void* buf=heap_alloc_internal(heap, size);
-heap_free_cache(heap);
-return buf;
+return heap_alloc_from_caller(heap, size, (size_t)__builtin_return_address(0));
 }
 
 void* heap_alloc_aligned(heap_t* heap, size_t size, size_t align)
@@ -37,17 +51,79 @@ assert(size!=0);
 assert(align!=0);
 assert(align>sizeof(size_t));
 assert(align%sizeof(size_t)==0);
-void* buf=heap_alloc_internal(heap, size+align);
+heap_lock(heap);
+void* buf=nullptr;
+#if HEAP_LARGE_THRESHOLD
+if(size+align>=HEAP_LARGE_THRESHOLD)
+	buf=heap_large_alloc(heap, size+align);
+#endif
+if(!buf)
+	buf=heap_alloc_internal(heap, size+align);
 heap_free_cache(heap);
-size_t buf_pos=(size_t)buf;
-if(buf_pos%align==0)
+heap_unlock(heap);
+if(!buf)
+	return nullptr;
+return heap_block_align(buf, align);
+}
+
+void* heap_alloc_ex(heap_t* heap, size_t size, uint32_t flags)
+{
+assert(heap!=nullptr);
+assert(size!=0);
+if(flags&HEAP_ALLOC_CACHE_LINE)
+	{
+	heap_lock(heap);
+	void* buf=heap_alloc_internal_isolated(heap, size);
+	heap_free_cache(heap);
+	heap_unlock(heap);
 	return buf;
-size_t buf_aligned=align_up(buf_pos, align);
-align=buf_aligned-buf_pos;
-heap_block_info_t* info=(heap_block_info_t*)(buf_aligned-sizeof(heap_block_info_t));
-info->header=align;
-info->aligned=true;
-return (void*)buf_aligned;
+	}
+if(!(flags&HEAP_ALLOC_SHORT_LIVED))
+	return heap_alloc_from_caller(heap, size, (size_t)__builtin_return_address(0));
+heap_lock(heap);
+void* buf=nullptr;
+#if HEAP_LARGE_THRESHOLD
+if(size>=HEAP_LARGE_THRESHOLD)
+	{
+	buf=heap_large_alloc(heap, size);
+	heap_unlock(heap);
+	return buf;
+	}
+#endif
+buf=heap_alloc_internal_short(heap, size);
+heap_free_cache(heap);
+heap_unlock(heap);
+return buf;
+}
+
+heap_handle_t heap_alloc_movable(heap_t* heap, size_t size)
+{
+assert(heap!=nullptr);
+assert(size!=0);
+heap_lock(heap);
+size_t* buf=(size_t*)heap_alloc_internal(heap, size+sizeof(size_t));
+if(!buf)
+	{
+	heap_free_cache(heap);
+	heap_unlock(heap);
+	return 0;
+	}
+heap_block_info_t info;
+heap_block_get_info(heap, buf, &info);
+heap_handle_t handle=heap_handle_create(heap, info.offset);
+if(!handle)
+	{
+	heap_free_to_map(heap, buf);
+	heap_free_cache(heap);
+	heap_unlock(heap);
+	return 0;
+	}
+info.movable=true;
+heap_block_init(heap, &info);
+*buf=handle;
+heap_free_cache(heap);
+heap_unlock(heap);
+return handle;
 }
 
 size_t heap_available(heap_t* heap)
@@ -57,17 +133,141 @@ if(heap==nullptr)
 return heap->free;
 }
 
+size_t heap_compact(heap_t* heap, size_t budget)
+{
+assert(heap!=nullptr);
+heap_lock(heap);
+size_t heap_start=(size_t)heap+sizeof(heap_t);
+size_t offset=heap->compact_offset;
+if(offset<heap_start)
+	offset=heap_start;
+size_t moved=0;
+size_t heap_work=heap->work;
+size_t work=0;
+while(work<budget)
+	{
+	size_t heap_end=(size_t)heap+heap->used;
+	if(offset>=heap_end)
+		{
+		offset=heap_start;
+		break;
+		}
+	heap_block_info_t info;
+	info.offset=offset;
+	info.header=*(size_t*)offset;
+	size_t next_offset=offset+info.size;
+	work+=sizeof(size_t);
+	if(!info.free||next_offset>=heap_end)
+		{
+		offset=next_offset;
+		continue;
+		}
+	heap_block_info_t next_info;
+	next_info.offset=next_offset;
+	next_info.header=*(size_t*)next_offset;
+	if(next_info.free||!next_info.movable)
+		{
+		offset=next_offset;
+		continue;
+		}
+	size_t* next_buf=(size_t*)heap_block_get_pointer(next_offset);
+	heap_handle_entry_t* entry=heap_handle_get_entry(heap, *next_buf);
+	if(entry->pins)
+		{
+		offset=next_offset+next_info.size;
+		continue;
+		}
+	block_map_remove_block(heap, (block_map_t*)&heap->map_free, &info);
+	heap->free-=info.size;
+	memmove((void*)offset, (void*)next_offset, next_info.size);
+	next_info.offset=offset;
+	next_info.previous_free=false;
+	heap_block_init(heap, &next_info);
+	entry->offset=offset;
+	heap_block_info_t free_info;
+	free_info.header=0;
+	free_info.offset=offset+next_info.size;
+	free_info.size=info.size;
+	void* free_buf=heap_block_init(heap, &free_info);
+	offset=free_info.offset;
+	heap->compact_offset=offset;
+	heap_free_to_map(heap, free_buf);
+	offset=heap->compact_offset;
+	moved+=next_info.size;
+	work+=next_info.size;
+	}
+heap->compact_offset=offset;
+heap->work=heap_work;
+heap_free_cache(heap);
+heap_unlock(heap);
+return moved;
+}
+
 heap_t* heap_create(size_t offset, size_t size)
 {
 offset=align_up(offset, sizeof(size_t));
 size=align_down(size, sizeof(size_t));
 assert(size>sizeof(heap_t));
+assert(size-1<=(heap_offset_t)-1);
 heap_t* heap=(heap_t*)offset;
 heap->free=size-sizeof(heap_t);
 heap->used=sizeof(heap_t);
 heap->size=size;
 heap->free_block=0;
 block_map_init((block_map_t*)&heap->map_free);
+heap->handles=0;
+heap->handle_count=0;
+heap->handle_free=0;
+heap->handle_used=0;
+heap->compact_offset=0;
+heap->meta_free=0;
+heap->meta_extra=0;
+heap->meta_count=0;
+heap->meta_reserve=0;
+heap->meta_end=0;
+heap->meta_failed=false;
+heap->work=0;
+heap->work_max=0;
+heap->miss_work_max=0;
+heap->large=0;
+heap->large_size=0;
+for(uint32_t u=0; u<HEAP_SPARE_CLASSES; u++)
+	{
+	heap->spare[u]=0;
+	heap->spare_count[u]=0;
+	}
+heap->pending_bin=0;
+heap->pending_count=0;
+heap->pending_size=0;
+for(uint32_t u=0; u<HEAP_PENDING_BINS; u++)
+	heap->pending[u]=0;
+#if HEAP_SITES
+heap->site_age=0;
+for(uint32_t u=0; u<HEAP_SITES; u++)
+	{
+	heap_site_t* site=&heap->sites[u];
+	site->address=0;
+	site->hits=0;
+	site->chunk=0;
+	site->start=0;
+	}
+#endif
+#if HEAP_HOT_LISTS
+heap->hot_age=0;
+for(uint32_t u=0; u<HEAP_HOT_LISTS; u++)
+	{
+	heap_hot_list_t* list=&heap->hot_lists[u];
+	list->size=0;
+	list->hits=0;
+	list->first=0;
+	list->count=0;
+	}
+#endif
+#if HEAP_THREADSAFE
+heap_lock_init(&heap->lock);
+#endif
+heap_meta_init(heap);
+while(heap_meta_reserve(heap));
 return heap;
 }
 
@@ -76,58 +276,441 @@ void heap_free(heap_t* heap, void* buf)
 assert(heap!=nullptr);
 if(!buf)
 	return;
-size_t offset=(size_t)buf;
-heap_block_info_t* info=(heap_block_info_t*)(offset-sizeof(heap_block_info_t));
-if(info->aligned)
-	buf=(void*)(offset-info->size);
+heap_lock(heap);
+heap_free_internal(heap, buf);
+heap_free_cache(heap);
+heap_unlock(heap);
+}
+
+void heap_free_batch(heap_t* heap, void* const* bufs, size_t count)
+{
+assert(heap!=nullptr);
+heap_lock(heap);
+for(size_t u=0; u<count; u++)
+	{
+	if(bufs[u])
+		heap_free_internal(heap, bufs[u]);
+	}
+heap_free_cache(heap);
+heap_unlock(heap);
+}
+
+void heap_free_movable(heap_t* heap, heap_handle_t handle)
+{
+assert(heap!=nullptr);
+if(!handle)
+	return;
+heap_lock(heap);
+heap_handle_entry_t* entry=heap_handle_get_entry(heap, handle);
+assert(entry->pins==0);
+void* buf=heap_block_get_pointer(entry->offset);
+heap_handle_release(heap, handle);
 heap_free_to_map(heap, buf);
 heap_free_cache(heap);
+heap_unlock(heap);
+}
+
+size_t heap_get_fragmentation(heap_t* heap)
+{
+assert(heap!=nullptr);
+if(!heap->free)
+	return 0;
+return heap->pending_size*100/heap->free;
+}
+
+size_t heap_get_free_block_count(heap_t* heap)
+{
+assert(heap!=nullptr);
+return heap->map_count;
+}
+
+size_t heap_get_large_size(heap_t* heap)
+{
+assert(heap!=nullptr);
+return heap->large_size;
 }
 
 size_t heap_get_largest_free_block(heap_t* heap)
 {
 assert(heap!=nullptr);
+heap_lock(heap);
 size_t free=heap->size-heap->used;
-if(!heap->map_free)
-	return free;
 size_t largest=block_map_get_last_size((block_map_t*)&heap->map_free);
+heap_unlock(heap);
 if(free>largest)
 	largest=free;
 return largest;
 }
 
+void heap_get_lock_stats(heap_t* heap, heap_lock_stats_t* stats)
+{
+assert(heap!=nullptr);
+assert(stats!=nullptr);
+#if HEAP_THREADSAFE
+heap_lock(heap);
+*stats=heap->lock.stats;
+heap_unlock(heap);
+#else
+memset(stats, 0, sizeof(heap_lock_stats_t));
+#endif
+}
+
+size_t heap_get_miss_work_max(heap_t* heap)
+{
+assert(heap!=nullptr);
+return heap->miss_work_max;
+}
+
+size_t heap_maintain(heap_t* heap, size_t budget)
+{
+assert(heap!=nullptr);
+heap_lock(heap);
+size_t heap_work=heap->work;
+size_t work=heap_pending_flush(heap, budget);
+while(work<budget&&heap->free_block)
+	{
+	size_t* buf=(size_t*)heap_block_get_pointer(heap->free_block);
+	heap->free_block=*buf;
+	heap_free_to_map(heap, buf);
+	work++;
+	}
+while(work<budget&&heap_meta_reserve(heap))
+	work++;
+heap->work=heap_work;
+size_t count=heap->pending_count;
+heap_unlock(heap);
+return count;
+}
+
+size_t heap_get_work_max(heap_t* heap)
+{
+assert(heap!=nullptr);
+return heap->work_max;
+}
+
+void* heap_pin(heap_t* heap, heap_handle_t handle)
+{
+assert(heap!=nullptr);
+assert(handle!=0);
+heap_lock(heap);
+heap_handle_entry_t* entry=heap_handle_get_entry(heap, handle);
+entry->pins++;
+size_t* buf=(size_t*)heap_block_get_pointer(entry->offset);
+heap_unlock(heap);
+return buf+1;
+}
+
+bool heap_prepare(heap_t* heap, heap_profile_t const* profile)
+{
+assert(heap!=nullptr);
+assert(profile!=nullptr);
+heap_lock(heap);
+bool prepared=true;
+if(profile->lock)
+	{
+#ifdef __unix__
+	if(mlock(heap, heap->size)!=0)
+		prepared=false;
+#else
+	prepared=false;
+#endif
+	}
+if(heap->meta_reserve<profile->groups)
+	heap->meta_reserve=profile->groups;
+while(heap->meta_count<heap->meta_reserve)
+	{
+	if(!heap_meta_grow(heap))
+		{
+		prepared=false;
+		break;
+		}
+	}
+while(heap->handle_count<profile->handles)
+	{
+	if(!heap_handle_grow(heap))
+		{
+		prepared=false;
+		break;
+		}
+	}
+for(size_t u=0; u<profile->size_count; u++)
+	{
+#if HEAP_HOT_LISTS
+	if(!heap_hot_list_prepare(heap, profile->sizes[u]))
+		prepared=false;
+#elif HEAP_DEFERRED_FREE
+	if(!heap_pending_prepare(heap, profile->sizes[u]))
+		prepared=false;
+#endif
+	}
+size_t heap_end=(size_t)heap+heap->size;
+for(size_t offset=(size_t)heap+heap->used; offset<heap_end; offset=align_down(offset+HEAP_PAGE_SIZE, HEAP_PAGE_SIZE))
+	*(volatile size_t*)offset=0;
+heap_free_cache(heap);
+heap_unlock(heap);
+return prepared;
+}
+
+void* heap_realloc(heap_t* heap, void* buf, size_t size)
+{
+assert(heap!=nullptr);
+if(!buf)
+	return heap_alloc(heap, size);
+assert(size!=0);
+heap_lock(heap);
+heap_block_info_t* header=(heap_block_info_t*)((size_t)buf-sizeof(heap_block_info_t));
+if(header->aligned)
+	{
+	void* new_buf=heap_realloc_aligned(heap, buf, size);
+	heap_free_cache(heap);
+	heap_unlock(heap);
+	return new_buf;
+	}
+if(heap_large_is_mapped(heap, buf))
+	{
+	void* new_buf=heap_large_realloc(heap, buf, size);
+	heap_unlock(heap);
+	return new_buf;
+	}
+heap_block_info_t info;
+heap_block_get_info(heap, buf, &info);
+size_t capacity=info.size-sizeof(size_t);
+if(size<=capacity)
+	{
+	heap_unlock(heap);
+	return buf;
+	}
+void* new_buf=nullptr;
+#if HEAP_LARGE_THRESHOLD
+if(size>=HEAP_LARGE_THRESHOLD)
+	new_buf=heap_large_alloc(heap, size);
+#endif
+if(!new_buf)
+	new_buf=heap_alloc_internal(heap, size);
+if(new_buf)
+	{
+	memcpy(new_buf, buf, capacity);
+	heap_free_internal(heap, buf);
+	}
+heap_free_cache(heap);
+heap_unlock(heap);
+return new_buf;
+}
+
+void heap_release_range(heap_t* heap, size_t offset, size_t size)
+{
+assert(heap!=nullptr);
+heap_lock(heap);
+size_t res_start=offset-sizeof(size_t);
+heap_block_info_t info;
+heap_block_get_info(heap, heap_block_get_pointer(res_start), &info);
+assert(!info.free);
+assert(info.size==size+sizeof(size_t));
+heap_free_to_map(heap, heap_block_get_pointer(res_start));
+heap_free_cache(heap);
+heap_unlock(heap);
+}
+
+void heap_replenish(heap_t* heap)
+{
+assert(heap!=nullptr);
+heap_lock(heap);
+for(uint32_t cls=0; cls<HEAP_SPARE_CLASSES; cls++)
+	{
+	size_t size=heap_spare_get_size(cls);
+	while(__atomic_load_n(&heap->spare_count[cls], __ATOMIC_RELAXED)<HEAP_SPARE_DEPTH)
+		{
+		void* buf=heap_alloc_internal(heap, size-sizeof(size_t));
+		if(!buf)
+			break;
+		heap_spare_push(heap, cls, buf);
+		}
+	while(__atomic_load_n(&heap->spare_count[cls], __ATOMIC_RELAXED)>2*HEAP_SPARE_DEPTH)
+		{
+		void* buf=heap_spare_pop(heap, cls);
+		if(!buf)
+			break;
+		heap_free_internal(heap, buf);
+		}
+	}
+heap_free_cache(heap);
+heap_unlock(heap);
+}
+
 void heap_reserve(heap_t* heap, size_t offset, size_t size)
 {
 assert(heap!=nullptr);
 assert(size!=0);
 assert((size&0xFFFF)==0);
+heap_lock(heap);
 size_t heap_start=(size_t)heap;
 size_t heap_end=heap_start+heap->size;
 if(offset+size==heap_end)
 	{
 	heap->free-=size;
 	heap->size-=size;
+	heap_unlock(heap);
 	return;
 	}
 size_t res_start=offset-sizeof(size_t);
-size_t res_size=size+2*sizeof(size_t);
+size_t res_size=size+sizeof(size_t);
 size_t res_end=res_start+res_size;
 size_t heap_used=heap_start+heap->used;
 assert(res_start>heap_used);
 assert(res_end<heap_end);
 heap_block_info_t free_info;
+free_info.header=0;
 free_info.offset=heap_used;
 free_info.size=res_start-heap_used;
 free_info.free=true;
 heap_block_init(heap, &free_info);
 heap_block_info_t res_info;
+res_info.header=0;
 res_info.offset=res_start;
 res_info.size=res_size;
+res_info.previous_free=true;
 res_info.free=false;
 heap_block_init(heap, &res_info);
 heap->used=res_end-heap_start;
 heap->free-=res_size;
 block_map_add_block(heap, (block_map_t*)&heap->map_free, &free_info);
+heap_unlock(heap);
+}
+
+bool heap_reserve_range(heap_t* heap, size_t offset, size_t size)
+{
+assert(heap!=nullptr);
+assert(size!=0);
+assert(offset%sizeof(size_t)==0);
+assert(size%sizeof(size_t)==0);
+heap_lock(heap);
+size_t heap_start=(size_t)heap+sizeof(heap_t);
+size_t heap_used=(size_t)heap+heap->used;
+size_t res_start=offset-sizeof(size_t);
+size_t res_size=size+sizeof(size_t);
+size_t res_end=res_start+res_size;
+if(res_start<heap_start||res_end>(size_t)heap+heap->size)
+	{
+	heap_unlock(heap);
+	return false;
+	}
+heap_block_info_t free_info;
+free_info.header=0;
+if(res_start>=heap_used)
+	{
+	free_info.offset=heap_used;
+	free_info.size=res_start-heap_used;
+	}
+else
+	{
+	free_info.offset=heap_start;
+	free_info.header=*(size_t*)heap_start;
+	while(free_info.offset+free_info.size<=res_start)
+		{
+		free_info.offset+=free_info.size;
+		free_info.header=*(size_t*)free_info.offset;
+		}
+	if(!free_info.free||free_info.offset+free_info.size<res_end)
+		{
+		heap_unlock(heap);
+		return false;
+		}
+	}
+size_t head_size=res_start-free_info.offset;
+size_t tail_size=free_info.offset+free_info.size-res_end;
+if(free_info.offset>=heap_used)
+	tail_size=0;
+if((head_size>0&&head_size<BLOCK_SIZE_MIN)||(tail_size>0&&tail_size<BLOCK_SIZE_MIN))
+	{
+	heap_unlock(heap);
+	return false;
+	}
+if(free_info.offset<heap_used)
+	{
+	block_map_remove_block(heap, (block_map_t*)&heap->map_free, &free_info);
+	heap->free-=free_info.size;
+	}
+else
+	{
+	heap->free-=res_end-heap_used;
+	heap->used=res_end-(size_t)heap;
+	}
+heap_block_info_t res_info;
+res_info.header=0;
+res_info.offset=res_start;
+res_info.size=res_size;
+heap_block_init(heap, &res_info);
+if(tail_size)
+	{
+	heap_block_info_t tail_info;
+	tail_info.header=0;
+	tail_info.offset=res_end;
+	tail_info.size=tail_size;
+	heap_block_init(heap, &tail_info);
+	heap_free_to_map(heap, heap_block_get_pointer(res_end));
+	}
+else
+	{
+	heap_block_set_previous_free(heap, res_end, false);
+	}
+if(head_size)
+	{
+	heap_block_info_t head_info;
+	head_info.header=0;
+	head_info.offset=free_info.offset;
+	head_info.size=head_size;
+	heap_block_init(heap, &head_info);
+	heap_free_to_map(heap, heap_block_get_pointer(free_info.offset));
+	}
+heap_free_cache(heap);
+heap_unlock(heap);
+return true;
+}
+
+void* heap_try_alloc(heap_t* heap, size_t size)
+{
+assert(heap!=nullptr);
+assert(size!=0);
+size=heap_block_calc_size(size);
+uint32_t cls=heap_spare_get_class(size);
+if(heap_spare_get_size(cls)<size)
+	cls++;
+for(; cls<HEAP_SPARE_CLASSES; cls++)
+	{
+	void* buf=heap_spare_pop(heap, cls);
+	if(buf)
+		return buf;
+	}
+return nullptr;
+}
+
+bool heap_try_free(heap_t* heap, void* buf)
+{
+assert(heap!=nullptr);
+if(!buf)
+	return true;
+if(heap_large_is_mapped(heap, buf))
+	return false;
+heap_block_info_t info;
+heap_block_get_info(heap, buf, &info);
+if(info.aligned||info.movable)
+	return false;
+uint32_t cls=heap_spare_get_class(info.size);
+if(cls>=HEAP_SPARE_CLASSES)
+	return false;
+heap_spare_push(heap, cls, buf);
+return true;
+}
+
+void heap_unpin(heap_t* heap, heap_handle_t handle)
+{
+assert(heap!=nullptr);
+assert(handle!=0);
+heap_lock(heap);
+heap_handle_entry_t* entry=heap_handle_get_entry(heap, handle);
+assert(entry->pins>0);
+entry->pins--;
+heap_unlock(heap);
 }
 
 
@@ -166,14 +749,40 @@ info.size-=size;
 heap_block_init(heap, &info);
 info.offset+=free_size;
 info.size=size;
+info.previous_free=false;
 return heap_block_init(heap, &info);
 }
 
+void* heap_alloc_from_caller(heap_t* heap, size_t size, size_t caller)
+{
+heap_lock(heap);
+void* buf=nullptr;
+#if HEAP_LARGE_THRESHOLD
+if(size>=HEAP_LARGE_THRESHOLD)
+	{
+	buf=heap_large_alloc(heap, size);
+	heap_unlock(heap);
+	return buf;
+	}
+#endif
+#if HEAP_SITES
+buf=heap_site_alloc(heap, caller, size);
+#else
+(void)caller;
+#endif
+if(!buf)
+	buf=heap_alloc_internal(heap, size);
+heap_free_cache(heap);
+heap_unlock(heap);
+return buf;
+}
+
 void* heap_alloc_from_foot(heap_t* heap, size_t size)
 {
 if(heap->used+size>heap->size)
 	return nullptr;
 heap_block_info_t info;
+info.header=0;
 info.offset=(size_t)heap+heap->used;
 info.size=size;
 info.free=false;
@@ -182,182 +791,1200 @@ heap->used+=size;
 return heap_block_init(heap, &info);
 }
 
-void* heap_alloc_from_map(heap_t* heap, size_t size)
+void* heap_alloc_from_map(heap_t* heap, size_t size, bool tail)
 {
 block_map_t* map=(block_map_t*)&heap->map_free;
-if(!map->root)
-	return nullptr;
 heap_block_info_t info;
+info.header=0;
 if(!block_map_get_block(heap, map, size, &info))
 	return nullptr;
 heap->free-=info.size;
+heap_block_set_previous_free(heap, info.offset+info.size, false);
 size_t free_size=info.size-size;
 if(free_size>=BLOCK_SIZE_MIN)
 	{
 	heap_block_info_t free_info;
+	free_info.header=0;
 	free_info.offset=info.offset+size;
 	free_info.size=free_size;
 	free_info.free=false;
+	if(tail)
+		{
+		free_info.offset=info.offset;
+		free_info.previous_free=info.previous_free;
+		info.offset+=free_size;
+		info.previous_free=false;
+		}
 	void* free_buf=heap_block_init(heap, &free_info);
 	heap_free_to_cache(heap, free_buf);
 	info.size=size;
 	}
-info.free=false;
-return heap_block_init(heap, &info);
+info.free=false;
+return heap_block_init(heap, &info);
+}
+
+void* heap_alloc_from_pending(heap_t* heap, size_t size, bool tail)
+{
+size_t work=heap->work;
+heap_hot_list_flush_all(heap);
+heap_site_release_all(heap);
+heap_pending_flush(heap, heap->pending_count);
+size_t miss_work=heap->work-work;
+heap->work=work;
+if(miss_work>heap->miss_work_max)
+	heap->miss_work_max=miss_work;
+void* buf=heap_alloc_from_map(heap, size, tail);
+if(!buf)
+	buf=heap_alloc_from_foot(heap, size);
+return buf;
+}
+
+void* heap_alloc_internal(heap_t* heap, size_t size)
+{
+size=heap_block_calc_size(size);
+void* buf=heap_hot_list_alloc(heap, size);
+if(!buf)
+	buf=heap_pending_alloc(heap, size);
+if(!buf)
+	buf=heap_alloc_from_cache(heap, size);
+if(!buf)
+	buf=heap_alloc_from_map(heap, size, false);
+if(!buf)
+	buf=heap_alloc_from_foot(heap, size);
+if(!buf)
+	buf=heap_alloc_from_pending(heap, size, false);
+return buf;
+}
+
+void* heap_alloc_internal_isolated(heap_t* heap, size_t size)
+{
+size_t block_size=sizeof(size_t)+align_up(size, HEAP_CACHE_LINE);
+size_t slack=HEAP_CACHE_LINE+2*BLOCK_SIZE_MIN;
+void* buf=heap_alloc_internal(heap, block_size+slack-sizeof(size_t));
+if(!buf)
+	return nullptr;
+heap_block_info_t info;
+heap_block_get_info(heap, buf, &info);
+size_t line_offset=info.offset+sizeof(size_t);
+size_t head_size=align_up(line_offset, HEAP_CACHE_LINE)-line_offset;
+if(head_size>0&&head_size<BLOCK_SIZE_MIN)
+	head_size+=HEAP_CACHE_LINE;
+size_t tail_size=info.size-head_size-block_size;
+assert(tail_size>=BLOCK_SIZE_MIN);
+heap_block_info_t head_info;
+head_info.header=0;
+head_info.offset=info.offset;
+head_info.size=head_size;
+head_info.previous_free=info.previous_free;
+heap_block_info_t tail_info;
+tail_info.header=0;
+tail_info.offset=info.offset+head_size+block_size;
+tail_info.size=tail_size;
+info.offset+=head_size;
+info.size=block_size;
+if(head_size)
+	info.previous_free=false;
+buf=heap_block_init(heap, &info);
+heap_free_to_map(heap, heap_block_init(heap, &tail_info));
+if(head_size)
+	heap_free_to_map(heap, heap_block_init(heap, &head_info));
+return buf;
+}
+
+void* heap_alloc_internal_short(heap_t* heap, size_t size)
+{
+size=heap_block_calc_size(size);
+void* buf=heap_hot_list_alloc(heap, size);
+if(!buf)
+	buf=heap_pending_alloc(heap, size);
+if(!buf)
+	buf=heap_alloc_from_cache(heap, size);
+if(!buf)
+	buf=heap_alloc_from_map(heap, size, true);
+if(!buf)
+	buf=heap_alloc_from_foot(heap, size);
+if(!buf)
+	buf=heap_alloc_from_pending(heap, size, true);
+return buf;
+}
+
+void heap_free_cache(heap_t* heap)
+{
+static_assert(HEAP_WORK_BUDGET>=2*HEAP_WORK_FREE);
+if(heap->work+HEAP_WORK_FREE<=HEAP_WORK_BUDGET)
+	heap_meta_reserve(heap);
+if(heap->free_block&&heap->work+HEAP_WORK_FREE<=HEAP_WORK_BUDGET)
+	{
+	size_t* buf=(size_t*)heap_block_get_pointer(heap->free_block);
+	heap->free_block=*buf;
+	heap_free_to_map(heap, buf);
+	}
+if(heap->work+HEAP_WORK_FREE<=HEAP_WORK_BUDGET)
+	heap_site_age(heap);
+bool flush=true;
+#if HEAP_DEFERRED_FREE
+flush=heap_get_fragmentation(heap)>=HEAP_DEFERRED_THRESHOLD;
+#endif
+while(flush&&heap->pending_count&&heap->work+HEAP_WORK_FREE<=HEAP_WORK_BUDGET)
+	heap_pending_flush(heap, 1);
+if(heap->work>heap->work_max)
+	heap->work_max=heap->work;
+heap->work=0;
+}
+
+void heap_free_internal(heap_t* heap, void* buf)
+{
+size_t offset=(size_t)buf;
+heap_block_info_t* info=(heap_block_info_t*)(offset-sizeof(heap_block_info_t));
+if(info->aligned)
+	buf=(void*)(offset-info->size);
+if(heap_large_free(heap, buf))
+	return;
+#if HEAP_DEFERRED_FREE
+if(!heap_hot_list_free(heap, buf))
+	heap_pending_free(heap, buf);
+#else
+if(!heap_hot_list_free(heap, buf))
+	heap_free_to_map(heap, buf);
+#endif
+}
+
+void heap_free_to_cache(heap_t* heap, void* buf)
+{
+size_t* free_ptr=(size_t*)buf;
+heap_block_info_t free_info;
+heap_block_get_info(heap, free_ptr, &free_info);
+size_t* last_ptr=&heap->free_block;
+size_t next=0;
+while(*last_ptr)
+	{
+	size_t* next_ptr=(size_t*)heap_block_get_pointer(*last_ptr);
+	heap_block_info_t next_info;
+	heap_block_get_info(heap, next_ptr, &next_info);
+	if(next_info.size<=free_info.size)
+		{
+		next=next_info.offset;
+		break;
+		}
+	last_ptr=next_ptr;
+	}
+*last_ptr=free_info.offset;
+*free_ptr=next;
+}
+
+void heap_free_to_map(heap_t* heap, void* buf)
+{
+heap->meta_failed=false;
+heap_block_chain_t info;
+heap_block_get_chain(heap, buf, &info);
+size_t heap_end=(size_t)heap+heap->used;
+size_t offset=info.current.offset;
+size_t size=info.current.size;
+assert(offset>=(size_t)heap);
+assert(offset<heap_end);
+assert(offset+size<=heap_end);
+if(info.previous.free)
+	{
+	block_map_remove_block(heap, (block_map_t*)&heap->map_free, &info.previous);
+	offset=info.previous.offset;
+	size+=info.previous.size;
+	heap->free-=info.previous.size;
+	}
+if(heap->compact_offset>offset&&heap->compact_offset<=info.current.offset+info.current.size)
+	heap->compact_offset=offset;
+if(!info.next.offset)
+	{
+	heap->free+=size;
+	heap->used-=size;
+	return;
+	}
+if(info.next.free)
+	{
+	block_map_remove_block(heap, (block_map_t*)&heap->map_free, &info.next);
+	size+=info.next.size;
+	heap->free-=info.next.size;
+	if(heap->compact_offset==info.next.offset)
+		heap->compact_offset=offset;
+	}
+info.current.offset=offset;
+info.current.size=size;
+info.current.previous_free=false;
+info.current.movable=false;
+info.current.free=false;
+heap_block_init(heap, &info.current);
+bool added=block_map_add_block(heap, (block_map_t*)&heap->map_free, &info.current);
+heap_block_set_previous_free(heap, offset+size, added);
+if(added)
+	{
+	info.current.free=true;
+	heap_block_init(heap, &info.current);
+	heap->free+=size;
+	return;
+	}
+buf=heap_block_get_pointer(info.current.offset);
+heap_free_to_cache(heap, buf);
+}
+
+void* heap_realloc_aligned(heap_t* heap, void* buf, size_t size)
+{
+heap_block_info_t* header=(heap_block_info_t*)((size_t)buf-sizeof(heap_block_info_t));
+size_t shift=header->size;
+void* base=(void*)((size_t)buf-shift);
+size_t capacity=0;
+if(heap_large_is_mapped(heap, base))
+	{
+	heap_large_t* large=(heap_large_t*)base-1;
+	capacity=large->size-sizeof(heap_large_t);
+	}
+else
+	{
+	heap_block_info_t info;
+	heap_block_get_info(heap, base, &info);
+	capacity=info.size-sizeof(size_t);
+	}
+capacity-=shift;
+if(size<=capacity)
+	return buf;
+size_t align=(size_t)buf&(~(size_t)buf+1);
+void* new_buf=nullptr;
+#if HEAP_LARGE_THRESHOLD
+if(size+align>=HEAP_LARGE_THRESHOLD)
+	new_buf=heap_large_alloc(heap, size+align);
+#endif
+if(!new_buf)
+	new_buf=heap_alloc_internal(heap, size+align);
+if(!new_buf)
+	return nullptr;
+new_buf=heap_block_align(new_buf, align);
+memcpy(new_buf, buf, capacity);
+heap_free_internal(heap, buf);
+return new_buf;
+}
+
+
+//============
+// Heap-Arena
+//============
+
+void* heap_arena_alloc(heap_arena_t* arena, size_t size, size_t align)
+{
+assert(arena!=nullptr);
+assert(size!=0);
+if(align<sizeof(size_t))
+	align=sizeof(size_t);
+assert((align&(align-1))==0);
+size_t offset=align_up(arena->offset, align);
+if(arena->chunks&&offset+size<=arena->end)
+	{
+	arena->offset=offset+size;
+	return (void*)offset;
+	}
+size_t chunk_size=sizeof(size_t)+align+size;
+if(chunk_size<=arena->chunk_size)
+	{
+	size_t* chunk=(size_t*)heap_alloc(arena->heap, arena->chunk_size);
+	if(!chunk)
+		return nullptr;
+	*chunk=arena->chunks;
+	arena->chunks=(size_t)chunk;
+	arena->end=(size_t)chunk+arena->chunk_size;
+	offset=align_up((size_t)(chunk+1), align);
+	arena->offset=offset+size;
+	return (void*)offset;
+	}
+size_t* chunk=(size_t*)heap_alloc(arena->heap, chunk_size);
+if(!chunk)
+	return nullptr;
+if(arena->chunks)
+	{
+	size_t* head=(size_t*)arena->chunks;
+	*chunk=*head;
+	*head=(size_t)chunk;
+	}
+else
+	{
+	*chunk=0;
+	arena->chunks=(size_t)chunk;
+	arena->offset=(size_t)chunk+chunk_size;
+	arena->end=arena->offset;
+	}
+return (void*)align_up((size_t)(chunk+1), align);
+}
+
+heap_arena_t* heap_arena_create(heap_t* heap, size_t chunk_size)
+{
+assert(heap!=nullptr);
+assert(chunk_size>2*sizeof(size_t));
+heap_arena_t* arena=(heap_arena_t*)heap_alloc(heap, sizeof(heap_arena_t));
+if(!arena)
+	return nullptr;
+arena->heap=heap;
+arena->parent=0;
+arena->children=0;
+arena->previous=0;
+arena->next=0;
+arena->chunk_size=align_up(chunk_size, sizeof(size_t));
+arena->chunks=0;
+arena->offset=0;
+arena->end=0;
+return arena;
+}
+
+heap_arena_t* heap_arena_create_nested(heap_arena_t* parent, size_t chunk_size)
+{
+assert(parent!=nullptr);
+assert(chunk_size>2*sizeof(size_t));
+heap_arena_t* arena=(heap_arena_t*)heap_alloc(parent->heap, sizeof(heap_arena_t));
+if(!arena)
+	return nullptr;
+arena->heap=parent->heap;
+arena->parent=(size_t)parent;
+arena->children=0;
+arena->previous=0;
+arena->next=parent->children;
+if(parent->children)
+	((heap_arena_t*)parent->children)->previous=(size_t)arena;
+parent->children=(size_t)arena;
+arena->chunk_size=align_up(chunk_size, sizeof(size_t));
+arena->chunks=0;
+arena->offset=0;
+arena->end=0;
+return arena;
+}
+
+void heap_arena_destroy(heap_arena_t* arena)
+{
+if(!arena)
+	return;
+heap_arena_reset(arena);
+if(arena->parent)
+	{
+	heap_arena_t* parent=(heap_arena_t*)arena->parent;
+	if(arena->previous)
+		{
+		((heap_arena_t*)arena->previous)->next=arena->next;
+		}
+	else
+		{
+		parent->children=arena->next;
+		}
+	if(arena->next)
+		((heap_arena_t*)arena->next)->previous=arena->previous;
+	}
+heap_free(arena->heap, arena);
+}
+
+void heap_arena_reset(heap_arena_t* arena)
+{
+assert(arena!=nullptr);
+while(arena->children)
+	heap_arena_destroy((heap_arena_t*)arena->children);
+size_t chunk=arena->chunks;
+while(chunk)
+	{
+	size_t next=*(size_t*)chunk;
+	heap_free(arena->heap, (void*)chunk);
+	chunk=next;
+	}
+arena->chunks=0;
+arena->offset=0;
+arena->end=0;
+}
+
+
+//============
+// Heap-Block
+//============
+
+void* heap_block_align(void* buf, size_t align)
+{
+size_t buf_pos=(size_t)buf;
+size_t buf_aligned=align_up(buf_pos+1, align);
+heap_block_info_t* info=(heap_block_info_t*)(buf_aligned-sizeof(heap_block_info_t));
+info->header=buf_aligned-buf_pos;
+info->aligned=true;
+return (void*)buf_aligned;
+}
+
+void heap_block_get_chain(heap_t* heap, void* ptr, heap_block_chain_t* info)
+{
+size_t heap_offset=(size_t)heap;
+size_t heap_start=heap_offset+sizeof(heap_t);
+size_t offset=heap_block_get_offset(ptr);
+size_t* head_ptr=(size_t*)offset;
+info->current.offset=offset;
+info->current.header=*head_ptr;
+if(info->current.previous_free)
+	{
+	assert(offset>heap_start);
+	size_t* foot_ptr=(size_t*)offset;
+	foot_ptr--;
+	info->previous.header=*foot_ptr;
+	info->previous.offset=offset-info->previous.size;
+	}
+else
+	{
+	info->previous.header=0;
+	info->previous.offset=0;
+	}
+size_t heap_end=heap_offset+heap->used;
+size_t next_offset=offset+info->current.size;
+if(next_offset<heap_end)
+	{
+	head_ptr=(size_t*)next_offset;
+	info->next.offset=next_offset;
+	info->next.header=*head_ptr;
+	}
+else
+	{
+	info->next.header=0;
+	info->next.offset=0;
+	}
+}
+
+void heap_block_get_info(heap_t* heap, void* ptr, heap_block_info_t* info)
+{
+info->offset=heap_block_get_offset(ptr);
+assert(info->offset>=(size_t)heap+sizeof(heap_t));
+assert(info->offset<(size_t)heap+heap->used);
+size_t* head_ptr=(size_t*)info->offset;
+info->header=*head_ptr;
+assert(info->size>=2*sizeof(size_t));
+assert(info->offset+info->size<=(size_t)heap+heap->used);
+assert(!info->free||*((size_t*)(info->offset+info->size-sizeof(size_t)))==*head_ptr);
+}
+
+void* heap_block_init(heap_t* heap, heap_block_info_t const* info)
+{
+assert(info->size%sizeof(size_t)==0);
+assert(info->offset>=(size_t)heap+sizeof(heap_t));
+assert(info->offset+info->size<=(size_t)heap+heap->size);
+size_t* head_ptr=(size_t*)info->offset;
+*head_ptr=info->header;
+head_ptr++;
+if(info->free)
+	{
+	size_t* foot_ptr=(size_t*)(info->offset+info->size);
+	foot_ptr--;
+	*foot_ptr=info->header;
+	}
+return head_ptr;
+}
+
+void heap_block_set_previous_free(heap_t* heap, size_t offset, bool free)
+{
+if(offset>=(size_t)heap+heap->used)
+	return;
+heap_block_info_t* info=(heap_block_info_t*)(offset-sizeof(size_t));
+assert(!info->free);
+info->previous_free=free;
+}
+
+
+//=============
+// Heap-Handle
+//=============
+
+heap_handle_t heap_handle_create(heap_t* heap, size_t offset)
+{
+if(!heap->handle_free)
+	{
+	if(!heap_handle_grow(heap))
+		return 0;
+	}
+heap_handle_t handle=heap->handle_free;
+heap_handle_entry_t* entry=heap_handle_get_entry(heap, handle);
+heap->handle_free=entry->next;
+entry->offset=offset;
+entry->pins=0;
+heap->handle_used++;
+return handle;
+}
+
+heap_handle_entry_t* heap_handle_get_entry(heap_t* heap, heap_handle_t handle)
+{
+assert(handle>0&&handle<=heap->handle_count);
+heap_handle_entry_t* entries=(heap_handle_entry_t*)heap->handles;
+return entries-handle;
+}
+
+bool heap_handle_grow(heap_t* heap)
+{
+size_t old_count=heap->handle_count;
+size_t count=old_count*2;
+if(count<HEAP_HANDLE_COUNT_MIN)
+	count=HEAP_HANDLE_COUNT_MIN;
+size_t heap_end=(size_t)heap+heap->size;
+if(!old_count)
+	heap->handles=heap_end;
+if(heap->handles-old_count*sizeof(heap_handle_entry_t)!=heap_end)
+	return false;
+size_t grow=(count-old_count)*sizeof(heap_handle_entry_t);
+if(heap->size-heap->used<grow)
+	return false;
+heap->size-=grow;
+heap->free-=grow;
+heap_handle_entry_t* entries=(heap_handle_entry_t*)heap->handles;
+for(size_t u=old_count+1; u<=count; u++)
+	{
+	heap_handle_entry_t* entry=entries-u;
+	entry->offset=0;
+	entry->next=u+1;
+	}
+(entries-count)->next=heap->handle_free;
+heap->handle_count=count;
+heap->handle_free=old_count+1;
+return true;
+}
+
+void heap_handle_release(heap_t* heap, heap_handle_t handle)
+{
+heap_handle_entry_t* entry=heap_handle_get_entry(heap, handle);
+entry->offset=0;
+entry->next=heap->handle_free;
+heap->handle_free=handle;
+if(--heap->handle_used)
+	return;
+size_t table_size=heap->handle_count*sizeof(heap_handle_entry_t);
+if(heap->handles-table_size!=(size_t)heap+heap->size)
+	return;
+heap->size+=table_size;
+heap->free+=table_size;
+heap->handle_count=0;
+heap->handle_free=0;
+}
+
+
+//===============
+// Heap-Hot-List
+//===============
+
+void heap_hot_list_age(heap_t* heap)
+{
+#if HEAP_HOT_LISTS
+heap_hot_list_t* list=&heap->hot_lists[heap->hot_age];
+heap->hot_age=(heap->hot_age+1)%HEAP_HOT_LISTS;
+if(list->hits>0)
+	list->hits--;
+if(list->hits<HEAP_HOT_THRESHOLD)
+	heap_hot_list_flush(heap, list);
+#else
+(void)heap;
+#endif
+}
+
+void* heap_hot_list_alloc(heap_t* heap, size_t size)
+{
+#if HEAP_HOT_LISTS
+heap_hot_list_age(heap);
+heap_hot_list_t* list=heap_hot_list_get(heap, size);
+if(list->size!=size)
+	{
+	if(list->hits>0)
+		{
+		list->hits--;
+		return nullptr;
+		}
+	heap_hot_list_flush(heap, list);
+	list->size=size;
+	}
+if(list->hits<HEAP_HOT_HITS_MAX)
+	list->hits++;
+if(!list->first)
+	return nullptr;
+size_t* buf=(size_t*)heap_block_get_pointer(list->first);
+list->first=*buf;
+list->count--;
+heap->free-=size;
+return buf;
+#else
+(void)heap;
+(void)size;
+return nullptr;
+#endif
+}
+
+void heap_hot_list_flush(heap_t* heap, heap_hot_list_t* list)
+{
+while(list->first)
+	{
+	size_t* buf=(size_t*)heap_block_get_pointer(list->first);
+	list->first=*buf;
+	list->count--;
+	heap->free-=list->size;
+	heap_pending_free(heap, buf);
+	}
+}
+
+void heap_hot_list_flush_all(heap_t* heap)
+{
+#if HEAP_HOT_LISTS
+for(uint32_t u=0; u<HEAP_HOT_LISTS; u++)
+	heap_hot_list_flush(heap, &heap->hot_lists[u]);
+#else
+(void)heap;
+#endif
+}
+
+bool heap_hot_list_prepare(heap_t* heap, size_t size)
+{
+#if HEAP_HOT_LISTS
+size=heap_block_calc_size(size);
+heap_hot_list_t* list=heap_hot_list_get(heap, size);
+if(list->size!=size)
+	{
+	heap_hot_list_flush(heap, list);
+	list->size=size;
+	}
+list->hits=HEAP_HOT_HITS_MAX;
+while(list->count<HEAP_HOT_DEPTH)
+	{
+	void* buf=heap_alloc_from_map(heap, size, false);
+	if(!buf)
+		buf=heap_alloc_from_foot(heap, size);
+	if(!buf)
+		return false;
+	heap_hot_list_free(heap, buf);
+	}
+return true;
+#else
+(void)heap;
+(void)size;
+return false;
+#endif
+}
+
+bool heap_hot_list_free(heap_t* heap, void* buf)
+{
+#if HEAP_HOT_LISTS
+heap_block_info_t info;
+heap_block_get_info(heap, buf, &info);
+heap_hot_list_t* list=heap_hot_list_get(heap, info.size);
+if(list->size!=info.size||list->hits<HEAP_HOT_THRESHOLD)
+	return false;
+if(list->count==HEAP_HOT_DEPTH)
+	return false;
+*(size_t*)buf=list->first;
+list->first=info.offset;
+list->count++;
+heap->free+=info.size;
+return true;
+#else
+(void)heap;
+(void)buf;
+return false;
+#endif
+}
+
+
+//============
+// Heap-Large
+//============
+
+void* heap_large_alloc(heap_t* heap, size_t size)
+{
+#if HEAP_LARGE_THRESHOLD
+size_t map_size=align_up(size+sizeof(heap_large_t), HEAP_PAGE_SIZE);
+void* map=mmap(nullptr, map_size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+if(map==MAP_FAILED)
+	return nullptr;
+heap_large_t* large=(heap_large_t*)map;
+large->size=map_size;
+heap_large_link(heap, large);
+return large+1;
+#else
+(void)heap;
+(void)size;
+return nullptr;
+#endif
+}
+
+bool heap_large_free(heap_t* heap, void* buf)
+{
+#if HEAP_LARGE_THRESHOLD
+if(!heap_large_is_mapped(heap, buf))
+	return false;
+heap_large_t* large=(heap_large_t*)buf-1;
+heap_large_unlink(heap, large);
+munmap(large, large->size);
+return true;
+#else
+(void)heap;
+(void)buf;
+return false;
+#endif
+}
+
+void heap_large_link(heap_t* heap, heap_large_t* large)
+{
+large->previous=0;
+large->next=heap->large;
+if(large->next)
+	((heap_large_t*)large->next)->previous=(size_t)large;
+heap->large=(size_t)large;
+heap->large_size+=large->size;
+}
+
+void* heap_large_realloc(heap_t* heap, void* buf, size_t size)
+{
+#if HEAP_LARGE_THRESHOLD
+heap_large_t* large=(heap_large_t*)buf-1;
+size_t map_size=align_up(size+sizeof(heap_large_t), HEAP_PAGE_SIZE);
+if(map_size<=large->size)
+	return buf;
+heap_large_unlink(heap, large);
+void* map=mremap(large, large->size, map_size, MREMAP_MAYMOVE);
+if(map==MAP_FAILED)
+	{
+	heap_large_link(heap, large);
+	return nullptr;
+	}
+large=(heap_large_t*)map;
+large->size=map_size;
+heap_large_link(heap, large);
+return large+1;
+#else
+(void)heap;
+(void)buf;
+(void)size;
+return nullptr;
+#endif
+}
+
+void heap_large_unlink(heap_t* heap, heap_large_t* large)
+{
+if(large->previous)
+	{
+	((heap_large_t*)large->previous)->next=large->next;
+	}
+else
+	{
+	heap->large=large->next;
+	}
+if(large->next)
+	((heap_large_t*)large->next)->previous=large->previous;
+heap->large_size-=large->size;
+}
+
+
+//===========
+// Heap-Lock
+//===========
+
+void heap_lock_acquire(heap_lock_t* lock)
+{
+#if HEAP_THREADSAFE
+uint32_t state=0;
+if(__atomic_compare_exchange_n(&lock->state, &state, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+	{
+	lock->stats.acquisitions++;
+	return;
+	}
+timespec start;
+clock_gettime(CLOCK_MONOTONIC, &start);
+uint32_t spin=__atomic_load_n(&lock->spin, __ATOMIC_RELAXED);
+uint32_t spin_max=2*spin+10;
+if(spin_max>HEAP_LOCK_SPIN_MAX)
+	spin_max=HEAP_LOCK_SPIN_MAX;
+uint32_t count=0;
+bool acquired=false;
+for(; count<spin_max; count++)
+	{
+#if defined(__x86_64__)||defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	__asm__ __volatile__("yield");
+#endif
+	state=0;
+	if(__atomic_load_n(&lock->state, __ATOMIC_RELAXED)==0&&__atomic_compare_exchange_n(&lock->state, &state, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+		{
+		acquired=true;
+		break;
+		}
+	}
+if(!acquired)
+	{
+	while(__atomic_exchange_n(&lock->state, 2, __ATOMIC_ACQUIRE)!=0)
+		{
+#ifdef __linux__
+		syscall(SYS_futex, &lock->state, FUTEX_WAIT_PRIVATE, 2, nullptr, nullptr, 0);
+#else
+		sched_yield();
+#endif
+		}
+	}
+__atomic_store_n(&lock->spin, spin+((int32_t)count-(int32_t)spin)/8, __ATOMIC_RELAXED);
+timespec end;
+clock_gettime(CLOCK_MONOTONIC, &end);
+uint64_t wait=(uint64_t)(end.tv_sec-start.tv_sec)*1000000000+end.tv_nsec-start.tv_nsec;
+uint32_t bucket=wait? 63-__builtin_clzll(wait): 0;
+if(bucket>=HEAP_LOCK_BUCKETS)
+	bucket=HEAP_LOCK_BUCKETS-1;
+lock->stats.acquisitions++;
+lock->stats.contended++;
+lock->stats.waits[bucket]++;
+#else
+(void)lock;
+#endif
+}
+
+void heap_lock_init(heap_lock_t* lock)
+{
+memset(lock, 0, sizeof(heap_lock_t));
+}
+
+void heap_lock_release(heap_lock_t* lock)
+{
+#if HEAP_THREADSAFE
+if(__atomic_exchange_n(&lock->state, 0, __ATOMIC_RELEASE)==2)
+	{
+#ifdef __linux__
+	syscall(SYS_futex, &lock->state, FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+#endif
+	}
+#else
+(void)lock;
+#endif
+}
+
+
+//===========
+// Heap-Meta
+//===========
+
+void* heap_meta_alloc(heap_t* heap)
+{
+size_t* list=&heap->meta_free;
+if(!*list)
+	list=&heap->meta_extra;
+if(!*list)
+	return nullptr;
+size_t* buf=(size_t*)*list;
+*list=*buf;
+heap->meta_count--;
+return buf;
+}
+
+void heap_meta_free(heap_t* heap, void* buf)
+{
+size_t* list=&heap->meta_extra;
+if((size_t)buf<heap->meta_end)
+	list=&heap->meta_free;
+size_t* ptr=(size_t*)buf;
+*ptr=*list;
+*list=(size_t)buf;
+heap->meta_count++;
+}
+
+size_t heap_meta_get_slot_size()
+{
+static_assert(offsetof(block_map_parent_group_t, first_sizes)==sizeof(cluster_parent_group_t));
+static_assert(offsetof(offset_index_parent_group_t, first_offsets)==sizeof(cluster_parent_group_t));
+size_t slot_size=sizeof(block_map_parent_group_t);
+if(slot_size<sizeof(offset_index_parent_group_t))
+	slot_size=sizeof(offset_index_parent_group_t);
+if(slot_size<sizeof(block_map_item_group_t))
+	slot_size=sizeof(block_map_item_group_t);
+if(slot_size<sizeof(offset_index_item_group_t))
+	slot_size=sizeof(offset_index_item_group_t);
+return align_up(slot_size, sizeof(size_t));
+}
+
+bool heap_meta_grow(heap_t* heap)
+{
+size_t size=heap_block_calc_size(heap_meta_get_slot_size());
+void* buf=heap_hot_list_alloc(heap, size);
+if(!buf)
+	buf=heap_pending_alloc(heap, size);
+if(!buf)
+	buf=heap_alloc_from_cache(heap, size);
+if(!buf)
+	buf=heap_alloc_from_map(heap, size, false);
+if(!buf)
+	buf=heap_alloc_from_foot(heap, size);
+if(!buf)
+	{
+	heap->meta_failed=true;
+	return false;
+	}
+heap_meta_free(heap, buf);
+return true;
+}
+
+void heap_meta_init(heap_t* heap)
+{
+size_t slot_size=heap_meta_get_slot_size();
+size_t reserve=heap->size/HEAP_PAGE_SIZE;
+if(reserve<HEAP_META_RESERVE_MIN)
+	reserve=HEAP_META_RESERVE_MIN;
+if(reserve>HEAP_META_RESERVE)
+	reserve=HEAP_META_RESERVE;
+heap->meta_reserve=reserve;
+size_t share=heap->size/HEAP_META_SHARE/slot_size;
+if(share<reserve/2)
+	share=reserve/2;
+size_t count=reserve+share;
+size_t offset=(size_t)heap_alloc_from_foot(heap, heap_block_calc_size(count*slot_size));
+if(!offset)
+	return;
+heap->meta_end=offset+count*slot_size;
+for(size_t u=count; u>0; u--)
+	heap_meta_free(heap, (void*)(offset+(u-1)*slot_size));
+}
+
+bool heap_meta_reserve(heap_t* heap)
+{
+if(heap->meta_extra&&heap->meta_count>heap->meta_reserve)
+	{
+	size_t* buf=(size_t*)heap->meta_extra;
+	heap->meta_extra=*buf;
+	heap->meta_count--;
+	heap_free_to_map(heap, buf);
+	return true;
+	}
+if(heap->meta_count<heap->meta_reserve&&!heap->meta_failed)
+	return heap_meta_grow(heap);
+return false;
+}
+
+
+//==============
+// Heap-Pending
+//==============
+
+void* heap_pending_alloc(heap_t* heap, size_t size)
+{
+size_t* bin=heap_pending_get_bin(heap, size);
+if(!*bin)
+	return nullptr;
+size_t* buf=(size_t*)heap_block_get_pointer(*bin);
+heap_block_info_t info;
+heap_block_get_info(heap, buf, &info);
+if(info.size!=size)
+	return nullptr;
+*bin=*buf;
+heap->pending_count--;
+heap->pending_size-=size;
+heap->free-=size;
+return buf;
+}
+
+size_t heap_pending_flush(heap_t* heap, size_t budget)
+{
+size_t work=0;
+uint32_t empty=0;
+while(work<budget&&empty<HEAP_PENDING_BINS)
+	{
+	size_t* bin=&heap->pending[heap->pending_bin];
+	if(!*bin)
+		{
+		heap->pending_bin=(heap->pending_bin+1)%HEAP_PENDING_BINS;
+		empty++;
+		continue;
+		}
+	size_t* buf=(size_t*)heap_block_get_pointer(*bin);
+	heap_block_info_t info;
+	heap_block_get_info(heap, buf, &info);
+	*bin=*buf;
+	heap->pending_count--;
+	heap->pending_size-=info.size;
+	heap->free-=info.size;
+	heap_free_to_map(heap, buf);
+	empty=0;
+	work++;
+	}
+return work;
 }
 
-void* heap_alloc_internal(heap_t* heap, size_t size)
+void heap_pending_free(heap_t* heap, void* buf)
+{
+heap_block_info_t info;
+heap_block_get_info(heap, buf, &info);
+size_t* bin=heap_pending_get_bin(heap, info.size);
+*(size_t*)buf=*bin;
+*bin=info.offset;
+heap->pending_count++;
+heap->pending_size+=info.size;
+heap->free+=info.size;
+}
+
+bool heap_pending_prepare(heap_t* heap, size_t size)
 {
+#if HEAP_DEFERRED_FREE
 size=heap_block_calc_size(size);
-void* buf=heap_alloc_from_cache(heap, size);
-if(!buf)
-	buf=heap_alloc_from_map(heap, size);
-if(!buf)
-	buf=heap_alloc_from_foot(heap, size);
-return buf;
+for(uint32_t u=0; u<HEAP_HOT_DEPTH; u++)
+	{
+	void* buf=heap_alloc_from_map(heap, size, false);
+	if(!buf)
+		buf=heap_alloc_from_foot(heap, size);
+	if(!buf)
+		return false;
+	heap_pending_free(heap, buf);
+	}
+return true;
+#else
+(void)heap;
+(void)size;
+return false;
+#endif
 }
 
-void heap_free_cache(heap_t* heap)
+
+//===========
+// Heap-Site
+//===========
+
+void heap_site_age(heap_t* heap)
 {
-if(!heap->free_block)
-	return;
-size_t* buf=(size_t*)heap_block_get_pointer(heap->free_block);
-heap->free_block=*buf;
-heap_free_to_map(heap, buf);
+#if HEAP_SITES
+heap_site_t* site=&heap->sites[heap->site_age];
+heap->site_age=(heap->site_age+1)%HEAP_SITES;
+if(heap_site_is_empty(heap, site))
+	heap_site_release(heap, site);
+#else
+(void)heap;
+#endif
 }
 
-void heap_free_to_cache(heap_t* heap, void* buf)
+void* heap_site_alloc(heap_t* heap, size_t address, size_t size)
 {
-size_t* free_ptr=(size_t*)buf;
-heap_block_info_t free_info;
-heap_block_get_info(heap, free_ptr, &free_info);
-size_t* last_ptr=&heap->free_block;
-size_t next=0;
-while(*last_ptr)
+#if HEAP_SITES
+heap_site_t* site=heap_site_get(heap, address);
+if(site->address!=address)
 	{
-	size_t* next_ptr=(size_t*)heap_block_get_pointer(*last_ptr);
-	heap_block_info_t next_info;
-	heap_block_get_info(heap, next_ptr, &next_info);
-	if(next_info.size<=free_info.size)
+	if(site->hits>0)
 		{
-		next=next_info.offset;
-		break;
+		site->hits--;
+		return nullptr;
 		}
-	last_ptr=next_ptr;
+	heap_site_release(heap, site);
+	site->address=address;
 	}
-*last_ptr=free_info.offset;
-*free_ptr=next;
+if(site->hits<HEAP_SITE_HITS_MAX)
+	site->hits++;
+if(site->hits<HEAP_SITE_THRESHOLD)
+	return nullptr;
+size=heap_block_calc_size(size);
+if(size>HEAP_SITE_CHUNK/4)
+	return nullptr;
+void* buf=heap_site_carve(heap, site, size);
+if(buf)
+	return buf;
+heap_site_release(heap, site);
+void* chunk=heap_alloc_internal(heap, HEAP_SITE_CHUNK-sizeof(size_t));
+if(!chunk)
+	return nullptr;
+heap_block_info_t info;
+heap_block_get_info(heap, chunk, &info);
+heap->free+=info.size;
+site->chunk=info.offset;
+site->start=info.offset;
+return heap_site_carve(heap, site, size);
+#else
+(void)heap;
+(void)address;
+(void)size;
+return nullptr;
+#endif
+}
+
+void* heap_site_carve(heap_t* heap, heap_site_t* site, size_t size)
+{
+if(!site->chunk)
+	return nullptr;
+heap_block_info_t info;
+heap_block_get_info(heap, heap_block_get_pointer(site->chunk), &info);
+if(info.size==size)
+	{
+	site->chunk=0;
+	heap->free-=size;
+	return heap_block_get_pointer(info.offset);
+	}
+if(info.size<size+BLOCK_SIZE_MIN)
+	return nullptr;
+heap->free-=size;
+heap_block_info_t rest;
+rest.header=0;
+rest.offset=info.offset+size;
+rest.size=info.size-size;
+heap_block_init(heap, &rest);
+site->chunk=rest.offset;
+info.size=size;
+return heap_block_init(heap, &info);
 }
 
-void heap_free_to_map(heap_t* heap, void* buf)
+bool heap_site_is_empty(heap_t* heap, heap_site_t* site)
 {
+if(!site->chunk)
+	return false;
 heap_block_chain_t info;
-heap_block_get_chain(heap, buf, &info);
-size_t heap_end=(size_t)heap+heap->used;
-size_t offset=info.current.offset;
-size_t size=info.current.size;
-assert(offset>=(size_t)heap);
-assert(offset<heap_end);
-assert(offset+size<=heap_end);
-if(info.previous.free)
-	{
-	block_map_remove_block(heap, (block_map_t*)&heap->map_free, &info.previous);
-	offset=info.previous.offset;
-	size+=info.previous.size;
-	heap->free-=info.previous.size;
-	}
-if(!info.next.offset)
-	{
-	heap->free+=size;
-	heap->used-=size;
-	return;
-	}
-if(info.next.free)
-	{
-	block_map_remove_block(heap, (block_map_t*)&heap->map_free, &info.next);
-	size+=info.next.size;
-	heap->free-=info.next.size;
-	}
-info.current.offset=offset;
-info.current.size=size;
-info.current.free=false;
-heap_block_init(heap, &info.current);
-bool added=block_map_add_block(heap, (block_map_t*)&heap->map_free, &info.current);
-if(added)
-	{
-	info.current.free=true;
-	heap_block_init(heap, &info.current);
-	heap->free+=size;
+heap_block_get_chain(heap, heap_block_get_pointer(site->chunk), &info);
+if(!info.previous.free)
+	return false;
+return info.previous.offset<=site->start;
+}
+
+void heap_site_release(heap_t* heap, heap_site_t* site)
+{
+if(!site->chunk)
 	return;
-	}
-buf=heap_block_get_pointer(info.current.offset);
-heap_free_to_cache(heap, buf);
+void* buf=heap_block_get_pointer(site->chunk);
+heap_block_info_t info;
+heap_block_get_info(heap, buf, &info);
+heap->free-=info.size;
+site->chunk=0;
+heap_free_to_map(heap, buf);
+}
+
+void heap_site_release_all(heap_t* heap)
+{
+#if HEAP_SITES
+for(uint32_t u=0; u<HEAP_SITES; u++)
+	heap_site_release(heap, &heap->sites[u]);
+#else
+(void)heap;
+#endif
 }
 
 
 //============
-// Heap-Block
+// Heap-Spare
 //============
 
-void heap_block_get_chain(heap_t* heap, void* ptr, heap_block_chain_t* info)
+void* heap_spare_pop(heap_t* heap, uint32_t cls)
 {
-size_t heap_offset=(size_t)heap;
-size_t heap_start=heap_offset+sizeof(heap_t);
-size_t offset=heap_block_get_offset(ptr);
-size_t* head_ptr=(size_t*)offset;
-info->current.offset=offset;
-info->current.header=*head_ptr;
-if(offset>heap_start)
-	{
-	size_t* foot_ptr=(size_t*)offset;
-	foot_ptr--;
-	info->previous.header=*foot_ptr;
-	info->previous.offset=offset-info->previous.size;
-	}
-else
-	{
-	info->previous.header=0;
-	info->previous.offset=0;
-	}
-size_t heap_end=heap_offset+heap->used;
-size_t next_offset=offset+info->current.size;
-if(next_offset<heap_end)
-	{
-	head_ptr=(size_t*)next_offset;
-	info->next.offset=next_offset;
-	info->next.header=*head_ptr;
-	}
-else
+uint64_t* head_ptr=&heap->spare[cls];
+uint64_t head=__atomic_load_n(head_ptr, __ATOMIC_ACQUIRE);
+while(true)
 	{
-	info->next.header=0;
-	info->next.offset=0;
+	uint32_t offset=(uint32_t)head;
+	if(!offset)
+		return nullptr;
+	size_t* buf=(size_t*)heap_block_get_pointer(heap_get_absolute_offset(heap, offset));
+	size_t next=__atomic_load_n(buf, __ATOMIC_RELAXED);
+	uint64_t tag=(head>>32)+1;
+	if(__atomic_compare_exchange_n(head_ptr, &head, (tag<<32)|(uint32_t)next, true, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+		{
+		__atomic_fetch_sub(&heap->spare_count[cls], 1, __ATOMIC_RELAXED);
+		return buf;
+		}
 	}
 }
 
-void heap_block_get_info(heap_t* heap, void* ptr, heap_block_info_t* info)
-{
-info->offset=heap_block_get_offset(ptr);
-assert(info->offset>=(size_t)heap+sizeof(heap_t));
-assert(info->offset<(size_t)heap+heap->used);
-size_t* head_ptr=(size_t*)info->offset;
-info->header=*head_ptr;
-assert(info->size>=3*sizeof(size_t));
-assert(info->offset+info->size<=(size_t)heap+heap->used);
-assert(*((size_t*)(info->offset+info->size-sizeof(size_t)))==*head_ptr);
-}
-
-void* heap_block_init(heap_t* heap, heap_block_info_t const* info)
+void heap_spare_push(heap_t* heap, uint32_t cls, void* buf)
 {
-assert(info->size%sizeof(size_t)==0);
-assert(info->offset>=(size_t)heap+sizeof(heap_t));
-assert(info->offset+info->size<=(size_t)heap+heap->size);
-size_t* head_ptr=(size_t*)info->offset;
-*head_ptr=info->header;
-head_ptr++;
-size_t* foot_ptr=(size_t*)(info->offset+info->size);
-foot_ptr--;
-*foot_ptr=info->header;
-return head_ptr;
+size_t offset=heap_get_relative_offset(heap, heap_block_get_offset(buf));
+assert(offset<=0xFFFFFFFF);
+uint64_t* head_ptr=&heap->spare[cls];
+uint64_t head=__atomic_load_n(head_ptr, __ATOMIC_RELAXED);
+while(true)
+	{
+	__atomic_store_n((size_t*)buf, (uint32_t)head, __ATOMIC_RELAXED);
+	uint64_t tag=(head>>32)+1;
+	if(__atomic_compare_exchange_n(head_ptr, &head, (tag<<32)|offset, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+		break;
+	}
+__atomic_fetch_add(&heap->spare_count[cls], 1, __ATOMIC_RELAXED);
 }
 
 
@@ -365,26 +1992,34 @@ return head_ptr;
 // Cluster-Parent-Group
 //======================
 
-void cluster_parent_group_append_groups(cluster_parent_group_t* group, cluster_group_t* const* append, uint32_t count)
+void cluster_parent_group_append_groups(cluster_parent_group_t* group, uint32_t group_size, cluster_group_t* const* append, heap_offset_t const* firsts, heap_offset_t const* lasts, uint32_t count)
 {
 uint32_t child_count=group->header.child_count;
-assert(child_count+count<=HEAP_GROUP_SIZE);
+assert(child_count+count<=group_size);
+heap_offset_t* group_firsts=cluster_parent_group_get_firsts(group);
+heap_offset_t* group_lasts=cluster_parent_group_get_lasts(group, group_size);
+cluster_group_t** group_children=cluster_parent_group_get_children(group, group_size);
 for(uint32_t u=0; u<count; u++)
-	group->children[child_count+u]=append[u];
+	{
+	group_firsts[child_count+u]=firsts[u];
+	group_lasts[child_count+u]=lasts[u];
+	group_children[child_count+u]=append[u];
+	}
 group->header.child_count+=count;
 }
 
-void cluster_parent_group_cleanup(heap_t* heap, cluster_parent_group_t* group)
+void cluster_parent_group_cleanup(heap_t* heap, cluster_parent_group_t* group, uint32_t group_size)
 {
 if(!group->header.dirty)
 	return;
+cluster_group_t** children=cluster_parent_group_get_children(group, group_size);
 uint32_t child_count=group->header.child_count;
 for(uint32_t pos=0; pos<child_count; )
 	{
-	uint32_t count=group->children[pos]->child_count;
+	uint32_t count=children[pos]->child_count;
 	if(count==0)
 		{
-		cluster_parent_group_remove_group(heap, (cluster_parent_group_t*)group, pos);
+		cluster_parent_group_remove_group(heap, group, group_size, pos);
 		child_count--;
 		continue;
 		}
@@ -393,8 +2028,9 @@ for(uint32_t pos=0; pos<child_count; )
 group->header.dirty=false;
 }
 
-int16_t cluster_parent_group_get_nearest_space(cluster_parent_group_t* group, int16_t pos)
+int16_t cluster_parent_group_get_nearest_space(cluster_parent_group_t* group, uint32_t group_size, int16_t pos, uint32_t capacity)
 {
+cluster_group_t** children=cluster_parent_group_get_children(group, group_size);
 int16_t child_count=(int16_t)group->header.child_count;
 int16_t before=pos-1;
 int16_t after=pos+1;
@@ -402,15 +2038,15 @@ while(before>=0||after<child_count)
 	{
 	if(before>=0)
 		{
-		uint32_t count=group->children[before]->child_count;
-		if(count<HEAP_GROUP_SIZE)
+		uint32_t count=children[before]->child_count;
+		if(count<capacity)
 			return before;
 		before--;
 		}
 	if(after<child_count)
 		{
-		uint32_t count=group->children[after]->child_count;
-		if(count<HEAP_GROUP_SIZE)
+		uint32_t count=children[after]->child_count;
+		if(count<capacity)
 			return after;
 		after++;
 		}
@@ -418,37 +2054,62 @@ while(before>=0||after<child_count)
 return -1;
 }
 
-void cluster_parent_group_insert_groups(cluster_parent_group_t* group, uint32_t pos, cluster_group_t* const* insert, uint32_t count)
+void cluster_parent_group_insert_groups(cluster_parent_group_t* group, uint32_t group_size, uint32_t pos, cluster_group_t* const* insert, heap_offset_t const* firsts, heap_offset_t const* lasts, uint32_t count)
 {
 uint32_t child_count=group->header.child_count;
 assert(pos<=child_count);
-assert(child_count+count<=HEAP_GROUP_SIZE);
+assert(child_count+count<=group_size);
+heap_offset_t* group_firsts=cluster_parent_group_get_firsts(group);
+heap_offset_t* group_lasts=cluster_parent_group_get_lasts(group, group_size);
+cluster_group_t** group_children=cluster_parent_group_get_children(group, group_size);
 for(uint32_t u=child_count+count-1; u>=pos+count; u--)
-	group->children[u]=group->children[u-count];
+	{
+	group_firsts[u]=group_firsts[u-count];
+	group_lasts[u]=group_lasts[u-count];
+	group_children[u]=group_children[u-count];
+	}
 for(uint32_t u=0; u<count; u++)
-	group->children[pos+u]=insert[u];
+	{
+	group_firsts[pos+u]=firsts[u];
+	group_lasts[pos+u]=lasts[u];
+	group_children[pos+u]=insert[u];
+	}
 group->header.child_count+=count;
 }
 
-void cluster_parent_group_remove_group(heap_t* heap, cluster_parent_group_t* group, uint32_t pos)
+void cluster_parent_group_remove_group(heap_t* heap, cluster_parent_group_t* group, uint32_t group_size, uint32_t pos)
 {
 uint32_t child_count=group->header.child_count;
 assert(pos<child_count);
-cluster_group_t* child=group->children[pos];
+heap_offset_t* firsts=cluster_parent_group_get_firsts(group);
+heap_offset_t* lasts=cluster_parent_group_get_lasts(group, group_size);
+cluster_group_t** children=cluster_parent_group_get_children(group, group_size);
+cluster_group_t* child=children[pos];
 assert(child->child_count==0);
 for(uint32_t u=pos; u+1<child_count; u++)
-	group->children[u]=group->children[u+1];
+	{
+	firsts[u]=firsts[u+1];
+	lasts[u]=lasts[u+1];
+	children[u]=children[u+1];
+	}
 group->header.child_count--;
-heap_free_to_cache(heap, child);
+heap_meta_free(heap, child);
 }
 
-void cluster_parent_group_remove_groups(cluster_parent_group_t* group, uint32_t pos, uint32_t count)
+void cluster_parent_group_remove_groups(cluster_parent_group_t* group, uint32_t group_size, uint32_t pos, uint32_t count)
 {
 uint32_t child_count=group->header.child_count;
 assert(pos+count<=child_count);
+heap_offset_t* firsts=cluster_parent_group_get_firsts(group);
+heap_offset_t* lasts=cluster_parent_group_get_lasts(group, group_size);
+cluster_group_t** children=cluster_parent_group_get_children(group, group_size);
 for(uint32_t u=pos; u+count<child_count; u++)
-	group->children[u]=group->children[u+count];
-group->header.child_count-=count;;
+	{
+	firsts[u]=firsts[u+count];
+	lasts[u]=lasts[u+count];
+	children[u]=children[u+count];
+	}
+group->header.child_count-=count;
 }
 
 
@@ -456,7 +2117,7 @@ group->header.child_count-=count;;
 // Offset-Index-Group
 //====================
 
-bool offset_index_group_add_offset(heap_t* heap, offset_index_group_t* group, size_t offset, bool again)
+bool offset_index_group_add_offset(heap_t* heap, offset_index_group_t* group, heap_offset_t offset, bool again)
 {
 group->locked=true;
 bool added=false;
@@ -472,7 +2133,7 @@ group->locked=false;
 return added;
 }
 
-size_t offset_index_group_get_first_offset(offset_index_group_t* group)
+heap_offset_t offset_index_group_get_first_offset(offset_index_group_t* group)
 {
 if(group==nullptr)
 	return 0;
@@ -481,7 +2142,7 @@ if(group->level==0)
 return ((offset_index_parent_group_t*)group)->first_offset;
 }
 
-size_t offset_index_group_get_last_offset(offset_index_group_t* group)
+heap_offset_t offset_index_group_get_last_offset(offset_index_group_t* group)
 {
 if(group==nullptr)
 	return 0;
@@ -490,14 +2151,14 @@ if(group->level==0)
 return ((offset_index_parent_group_t*)group)->last_offset;
 }
 
-size_t offset_index_group_remove_last_offset(heap_t* heap, offset_index_group_t* group)
+heap_offset_t offset_index_group_remove_last_offset(heap_t* heap, offset_index_group_t* group)
 {
 if(group->level==0)
 	return offset_index_item_group_remove_last_offset((offset_index_item_group_t*)group);
 return offset_index_parent_group_remove_last_offset(heap, (offset_index_parent_group_t*)group, group->locked);
 }
 
-void offset_index_group_remove_offset(heap_t* heap, offset_index_group_t* group, size_t offset)
+void offset_index_group_remove_offset(heap_t* heap, offset_index_group_t* group, heap_offset_t offset)
 {
 if(group->level==0)
 	{
@@ -514,13 +2175,13 @@ else
 // Offset-Index-Item-Group
 //=========================
 
-bool offset_index_item_group_add_offset(offset_index_item_group_t* group, size_t offset)
+bool offset_index_item_group_add_offset(offset_index_item_group_t* group, heap_offset_t offset)
 {
 bool exists=false;
 uint32_t pos=offset_index_item_group_get_item_pos(group, offset, &exists);
 assert(!exists);
 uint32_t child_count=group->header.child_count;
-if(child_count==HEAP_GROUP_SIZE)
+if(child_count==OFFSET_INDEX_ITEM_GROUP_SIZE)
 	return false;
 for(uint32_t u=child_count; u>pos; u--)
 	group->items[u]=group->items[u-1];
@@ -529,10 +2190,10 @@ group->header.child_count++;
 return true;
 }
 
-void offset_index_item_group_append_items(offset_index_item_group_t* group, size_t const* append, uint32_t count)
+void offset_index_item_group_append_items(offset_index_item_group_t* group, heap_offset_t const* append, uint32_t count)
 {
 uint32_t child_count=group->header.child_count;
-assert(child_count+count<=HEAP_GROUP_SIZE);
+assert(child_count+count<=OFFSET_INDEX_ITEM_GROUP_SIZE);
 for(uint32_t u=0; u<count; u++)
 	group->items[child_count+u]=append[u];
 group->header.child_count+=count;
@@ -540,26 +2201,26 @@ group->header.child_count+=count;
 
 offset_index_item_group_t* offset_index_item_group_create(heap_t* heap)
 {
-offset_index_item_group_t* group=(offset_index_item_group_t*)heap_alloc_internal(heap, sizeof(offset_index_item_group_t));
+offset_index_item_group_t* group=(offset_index_item_group_t*)heap_meta_alloc(heap);
 if(group==nullptr)
 	return nullptr;
 group->header.value=0;
 return group;
 }
 
-size_t offset_index_item_group_get_first_offset(offset_index_item_group_t* group)
+heap_offset_t offset_index_item_group_get_first_offset(offset_index_item_group_t* group)
 {
 if(group->header.child_count==0)
 	return 0;
 return group->items[0];
 }
 
-uint32_t offset_index_item_group_get_item_pos(offset_index_item_group_t* group, size_t offset, bool* exists_ptr)
+uint32_t offset_index_item_group_get_item_pos(offset_index_item_group_t* group, heap_offset_t offset, bool* exists_ptr)
 {
 uint32_t child_count=group->header.child_count;
 for(uint32_t pos=0; pos<child_count; pos++)
 	{
-	size_t item=group->items[pos];
+	heap_offset_t item=group->items[pos];
 	if(item==offset)
 		{
 		*exists_ptr=true;
@@ -571,7 +2232,7 @@ for(uint32_t pos=0; pos<child_count; pos++)
 return child_count;
 }
 
-size_t offset_index_item_group_get_last_offset(offset_index_item_group_t* group)
+heap_offset_t offset_index_item_group_get_last_offset(offset_index_item_group_t* group)
 {
 uint32_t child_count=group->header.child_count;
 if(child_count==0)
@@ -579,7 +2240,7 @@ if(child_count==0)
 return group->items[child_count-1];
 }
 
-void offset_index_item_group_insert_items(offset_index_item_group_t* group, uint32_t pos, size_t const* insert, uint32_t count)
+void offset_index_item_group_insert_items(offset_index_item_group_t* group, uint32_t pos, heap_offset_t const* insert, uint32_t count)
 {
 uint32_t child_count=group->header.child_count;
 for(uint32_t u=child_count+count-1; u>=pos+count; u--)
@@ -589,11 +2250,11 @@ for(uint32_t u=0; u<count; u++)
 group->header.child_count+=count;
 }
 
-size_t offset_index_item_group_remove_item(offset_index_item_group_t* group, uint32_t pos)
+heap_offset_t offset_index_item_group_remove_item(offset_index_item_group_t* group, uint32_t pos)
 {
 uint32_t child_count=group->header.child_count;
 assert(pos<child_count);
-size_t offset=group->items[pos];
+heap_offset_t offset=group->items[pos];
 for(uint32_t u=pos; u+1<child_count; u++)
 	group->items[u]=group->items[u+1];
 group->header.child_count--;
@@ -609,14 +2270,14 @@ for(uint32_t u=pos; u+count<child_count; u++)
 group->header.child_count-=count;;
 }
 
-size_t offset_index_item_group_remove_last_offset(offset_index_item_group_t* group)
+heap_offset_t offset_index_item_group_remove_last_offset(offset_index_item_group_t* group)
 {
 uint32_t child_count=group->header.child_count;
 assert(child_count>0);
 return offset_index_item_group_remove_item(group, child_count-1);
 }
 
-void offset_index_item_group_remove_offset(offset_index_item_group_t* group, size_t offset)
+void offset_index_item_group_remove_offset(offset_index_item_group_t* group, heap_offset_t offset)
 {
 bool exists=false;
 uint32_t pos=offset_index_item_group_get_item_pos(group, offset, &exists);
@@ -629,16 +2290,16 @@ offset_index_item_group_remove_item(group, pos);
 // Offset-Index-Parent-Group
 //===========================
 
-bool offset_index_parent_group_add_offset(heap_t* heap, offset_index_parent_group_t* group, size_t offset, bool again)
+bool offset_index_parent_group_add_offset(heap_t* heap, offset_index_parent_group_t* group, heap_offset_t offset, bool again)
 {
 bool added=offset_index_parent_group_add_offset_internal(heap, group, offset, again);
-cluster_parent_group_cleanup(heap, (cluster_parent_group_t*)group);
+cluster_parent_group_cleanup(heap, (cluster_parent_group_t*)group, OFFSET_INDEX_PARENT_GROUP_SIZE);
 if(added)
 	offset_index_parent_group_update_bounds(group);
 return added;
 }
 
-bool offset_index_parent_group_add_offset_internal(heap_t* heap, offset_index_parent_group_t* group, size_t offset, bool again)
+bool offset_index_parent_group_add_offset_internal(heap_t* heap, offset_index_parent_group_t* group, heap_offset_t offset, bool again)
 {
 uint32_t child_count=group->header.child_count;
 if(!child_count)
@@ -649,7 +2310,9 @@ if(!again)
 	{
 	for(uint32_t u=0; u<count; u++)
 		{
-		if(offset_index_group_add_offset(heap, group->children[pos+u], offset, false))
+		bool added=offset_index_group_add_offset(heap, group->children[pos+u], offset, false);
+		offset_index_parent_group_update_child(group, pos+u);
+		if(added)
 			return true;
 		}
 	if(offset_index_parent_group_shift_children(group, pos, count))
@@ -657,7 +2320,9 @@ if(!again)
 		count=offset_index_parent_group_get_item_pos(group, offset, &pos, false);
 		for(uint32_t u=0; u<count; u++)
 			{
-			if(offset_index_group_add_offset(heap, group->children[pos+u], offset, false))
+			bool added=offset_index_group_add_offset(heap, group->children[pos+u], offset, false);
+			offset_index_parent_group_update_child(group, pos+u);
+			if(added)
 				return true;
 			}
 		}
@@ -667,33 +2332,36 @@ if(!offset_index_parent_group_split_child(heap, group, pos))
 count=offset_index_parent_group_get_item_pos(group, offset, &pos, false);
 for(uint32_t u=0; u<count; u++)
 	{
-	if(offset_index_group_add_offset(heap, group->children[pos+u], offset, true))
+	bool added=offset_index_group_add_offset(heap, group->children[pos+u], offset, true);
+	offset_index_parent_group_update_child(group, pos+u);
+	if(added)
 		return true;
 	}
 return false;
 }
 
-void offset_index_parent_group_append_groups(offset_index_parent_group_t* group, offset_index_group_t* const* append, uint32_t count)
+void offset_index_parent_group_append_groups(offset_index_parent_group_t* group, offset_index_group_t* const* append, heap_offset_t const* first_offsets, heap_offset_t const* last_offsets, uint32_t count)
 {
-cluster_parent_group_append_groups((cluster_parent_group_t*)group, (cluster_group_t* const*)append, count);
+cluster_parent_group_append_groups((cluster_parent_group_t*)group, OFFSET_INDEX_PARENT_GROUP_SIZE, (cluster_group_t* const*)append, first_offsets, last_offsets, count);
 offset_index_parent_group_update_bounds(group);
 }
 
 bool offset_index_parent_group_combine_child(heap_t* heap, offset_index_parent_group_t* group, uint32_t pos)
 {
+uint32_t capacity=offset_index_parent_group_get_child_capacity(group);
 uint32_t count=group->children[pos]->child_count;
 if(count==0)
 	{
-	cluster_parent_group_remove_group(heap, (cluster_parent_group_t*)group, pos);
+	cluster_parent_group_remove_group(heap, (cluster_parent_group_t*)group, OFFSET_INDEX_PARENT_GROUP_SIZE, pos);
 	return true;
 	}
 if(pos>0)
 	{
 	uint32_t before=group->children[pos-1]->child_count;
-	if(count+before<=HEAP_GROUP_SIZE)
+	if(count+before<=capacity)
 		{
 		offset_index_parent_group_move_children(group, pos, pos-1, count);
-		cluster_parent_group_remove_group(heap, (cluster_parent_group_t*)group, pos);
+		cluster_parent_group_remove_group(heap, (cluster_parent_group_t*)group, OFFSET_INDEX_PARENT_GROUP_SIZE, pos);
 		return true;
 		}
 	}
@@ -701,10 +2369,10 @@ uint32_t child_count=group->header.child_count;
 if(pos+1<child_count)
 	{
 	uint32_t after=group->children[pos+1]->child_count;
-	if(count+after<=HEAP_GROUP_SIZE)
+	if(count+after<=capacity)
 		{
 		offset_index_parent_group_move_children(group, pos+1, pos, after);
-		cluster_parent_group_remove_group(heap, (cluster_parent_group_t*)group, pos+1);
+		cluster_parent_group_remove_group(heap, (cluster_parent_group_t*)group, OFFSET_INDEX_PARENT_GROUP_SIZE, pos+1);
 		return true;
 		}
 	}
@@ -713,7 +2381,7 @@ return false;
 
 offset_index_parent_group_t* offset_index_parent_group_create(heap_t* heap, uint32_t level)
 {
-offset_index_parent_group_t* group=(offset_index_parent_group_t*)heap_alloc_internal(heap, sizeof(offset_index_parent_group_t));
+offset_index_parent_group_t* group=(offset_index_parent_group_t*)heap_meta_alloc(heap);
 if(group==nullptr)
 	return nullptr;
 group->header.value=0;
@@ -725,7 +2393,7 @@ return group;
 
 offset_index_parent_group_t* offset_index_parent_group_create_with_child(heap_t* heap, offset_index_group_t* child)
 {
-offset_index_parent_group_t* group=(offset_index_parent_group_t*)heap_alloc_internal(heap, sizeof(offset_index_parent_group_t));
+offset_index_parent_group_t* group=(offset_index_parent_group_t*)heap_meta_alloc(heap);
 if(group==nullptr)
 	return nullptr;
 group->header.value=0;
@@ -733,23 +2401,26 @@ group->header.child_count=1;
 group->header.level=child->level+1;
 group->first_offset=offset_index_group_get_first_offset(child);
 group->last_offset=offset_index_group_get_last_offset(child);
+group->first_offsets[0]=group->first_offset;
+group->last_offsets[0]=group->last_offset;
 group->children[0]=child;
 return group;
 }
 
-uint32_t offset_index_parent_group_get_item_pos(offset_index_parent_group_t* group, size_t offset, uint32_t* pos_ptr, bool must_exist)
+uint32_t offset_index_parent_group_get_item_pos(offset_index_parent_group_t* group, heap_offset_t offset, uint32_t* pos_ptr, bool must_exist)
 {
 uint32_t child_count=group->header.child_count;
 uint32_t pos=0;
 for(; pos<child_count; pos++)
 	{
-	size_t first_offset=offset_index_group_get_first_offset(group->children[pos]);
+	heap_offset_t first_offset=group->first_offsets[pos];
 	assert(offset!=0);
 	if(offset<first_offset)
 		break;
-	size_t last_offset=offset_index_group_get_last_offset(group->children[pos]);
+	heap_offset_t last_offset=group->last_offsets[pos];
 	if(offset>last_offset)
 		continue;
+	__builtin_prefetch(group->children[pos]);
 	*pos_ptr=pos;
 	return 1;
 	}
@@ -769,9 +2440,9 @@ if(pos==child_count)
 return 2;
 }
 
-void offset_index_parent_group_insert_groups(offset_index_parent_group_t* group, uint32_t at, offset_index_group_t* const* insert, uint32_t count)
+void offset_index_parent_group_insert_groups(offset_index_parent_group_t* group, uint32_t at, offset_index_group_t* const* insert, heap_offset_t const* first_offsets, heap_offset_t const* last_offsets, uint32_t count)
 {
-cluster_parent_group_insert_groups((cluster_parent_group_t*)group, at, (cluster_group_t* const*)insert, count);
+cluster_parent_group_insert_groups((cluster_parent_group_t*)group, OFFSET_INDEX_PARENT_GROUP_SIZE, at, (cluster_group_t* const*)insert, first_offsets, last_offsets, count);
 offset_index_parent_group_update_bounds(group);
 }
 
@@ -784,13 +2455,13 @@ if(level>1)
 	offset_index_parent_group_t* dst=(offset_index_parent_group_t*)group->children[to];
 	if(from>to)
 		{
-		offset_index_parent_group_append_groups(dst, src->children, count);
+		offset_index_parent_group_append_groups(dst, src->children, src->first_offsets, src->last_offsets, count);
 		offset_index_parent_group_remove_groups(src, 0, count);
 		}
 	else
 		{
 		uint32_t src_count=src->header.child_count;
-		offset_index_parent_group_insert_groups(dst, 0, &src->children[src_count-count], count);
+		offset_index_parent_group_insert_groups(dst, 0, &src->children[src_count-count], &src->first_offsets[src_count-count], &src->last_offsets[src_count-count], count);
 		offset_index_parent_group_remove_groups(src, src_count-count, count);
 		}
 	}
@@ -810,6 +2481,8 @@ else
 		offset_index_item_group_remove_items(src, src_count-count, count);
 		}
 	}
+offset_index_parent_group_update_child(group, from);
+offset_index_parent_group_update_child(group, to);
 }
 
 void offset_index_parent_group_move_empty_slot(offset_index_parent_group_t* group, uint32_t from, uint32_t to)
@@ -828,15 +2501,16 @@ else
 
 void offset_index_parent_group_remove_groups(offset_index_parent_group_t* group, uint32_t at, uint32_t count)
 {
-cluster_parent_group_remove_groups((cluster_parent_group_t*)group, at, count);
+cluster_parent_group_remove_groups((cluster_parent_group_t*)group, OFFSET_INDEX_PARENT_GROUP_SIZE, at, count);
 offset_index_parent_group_update_bounds(group);
 }
 
-size_t offset_index_parent_group_remove_last_offset(heap_t* heap, offset_index_parent_group_t* group, bool passive)
+heap_offset_t offset_index_parent_group_remove_last_offset(heap_t* heap, offset_index_parent_group_t* group, bool passive)
 {
 uint32_t child_count=group->header.child_count;
 assert(child_count>0);
-size_t offset=offset_index_group_remove_last_offset(heap, group->children[child_count-1]);
+heap_offset_t offset=offset_index_group_remove_last_offset(heap, group->children[child_count-1]);
+offset_index_parent_group_update_child(group, child_count-1);
 if(passive)
 	{
 	group->header.dirty=true;
@@ -849,19 +2523,21 @@ offset_index_parent_group_update_bounds(group);
 return offset;
 }
 
-void offset_index_parent_group_remove_offset(heap_t* heap, offset_index_parent_group_t* group, size_t offset)
+void offset_index_parent_group_remove_offset(heap_t* heap, offset_index_parent_group_t* group, heap_offset_t offset)
 {
 uint32_t pos=0;
 uint32_t count=offset_index_parent_group_get_item_pos(group, offset, &pos, true);
 assert(count==1);
 offset_index_group_remove_offset(heap, group->children[pos], offset);
+offset_index_parent_group_update_child(group, pos);
 offset_index_parent_group_combine_child(heap, group, pos);
 offset_index_parent_group_update_bounds(group);
 }
 
 bool offset_index_parent_group_shift_children(offset_index_parent_group_t* group, uint32_t at, uint32_t count)
 {
-int16_t space=cluster_parent_group_get_nearest_space((cluster_parent_group_t*)group, at);
+uint32_t capacity=offset_index_parent_group_get_child_capacity(group);
+int16_t space=cluster_parent_group_get_nearest_space((cluster_parent_group_t*)group, OFFSET_INDEX_PARENT_GROUP_SIZE, at, capacity);
 if(space<0)
 	return false;
 if(count>1&&space>at)
@@ -873,7 +2549,7 @@ return true;
 bool offset_index_parent_group_split_child(heap_t* heap, offset_index_parent_group_t* group, uint32_t at)
 {
 uint32_t child_count=group->header.child_count;
-if(child_count==HEAP_GROUP_SIZE)
+if(child_count==OFFSET_INDEX_PARENT_GROUP_SIZE)
 	return false;
 offset_index_group_t* child=nullptr;
 uint32_t level=group->header.level;
@@ -887,10 +2563,8 @@ else
 	}
 if(!child)
 	return false;
-for(uint32_t u=child_count; u>at+1; u--)
-	group->children[u]=group->children[u-1];
-group->children[at+1]=child;
-group->header.child_count++;
+heap_offset_t bounds=0;
+offset_index_parent_group_insert_groups(group, at+1, &child, &bounds, &bounds, 1);
 offset_index_parent_group_move_children(group, at, at+1, 1);
 return true;
 }
@@ -906,46 +2580,56 @@ if(child_count==0)
 	}
 for(uint32_t pos=0; pos<child_count; pos++)
 	{
-	group->first_offset=offset_index_group_get_first_offset(group->children[pos]);
+	group->first_offset=group->first_offsets[pos];
 	if(group->first_offset!=0)
 		break;
 	}
 for(uint32_t pos=child_count; pos>0; pos--)
 	{
-	group->last_offset=offset_index_group_get_last_offset(group->children[pos-1]);
+	group->last_offset=group->last_offsets[pos-1];
 	if(group->last_offset!=0)
 		break;
 	}
 }
 
+void offset_index_parent_group_update_child(offset_index_parent_group_t* group, uint32_t pos)
+{
+offset_index_group_t* child=group->children[pos];
+group->first_offsets[pos]=offset_index_group_get_first_offset(child);
+group->last_offsets[pos]=offset_index_group_get_last_offset(child);
+}
+
 
 //==============
 // Offset-Index
 //==============
 
-bool offset_index_add_offset(heap_t* heap, offset_index_t* index, size_t offset)
+bool offset_index_add_offset(heap_t* heap, offset_index_t* index, heap_offset_t offset)
 {
-if(!index->root)
+offset_index_group_t* root=offset_index_get_root(heap, index);
+if(!root)
 	{
-	index->root=(offset_index_group_t*)offset_index_item_group_create(heap);
-	if(!index->root)
+	root=(offset_index_group_t*)offset_index_item_group_create(heap);
+	if(!root)
 		return false;
+	offset_index_set_root(heap, index, root);
 	}
-if(offset_index_group_add_offset(heap, index->root, offset, false))
+if(offset_index_group_add_offset(heap, root, offset, false))
 	return true;
 if(!offset_index_lift_root(heap, index))
 	return false;
-return offset_index_group_add_offset(heap, index->root, offset, true);
+root=offset_index_get_root(heap, index);
+return offset_index_group_add_offset(heap, root, offset, true);
 }
 
-size_t offset_index_drop_root(heap_t* heap, offset_index_t* index)
+heap_offset_t offset_index_drop_root(heap_t* heap, offset_index_t* index)
 {
-offset_index_group_t* root=index->root;
+offset_index_group_t* root=offset_index_get_root(heap, index);
 uint32_t child_count=root->child_count;
 uint32_t level=root->level;
 if(level==0)
 	{
-	size_t offset=0;
+	heap_offset_t offset=0;
 	if(child_count==1)
 		{
 		offset=offset_index_item_group_get_first_offset((offset_index_item_group_t*)root);
@@ -953,8 +2637,8 @@ if(level==0)
 		}
 	if(child_count==0)
 		{
-		index->root=nullptr;
-		heap_free_to_cache(heap, root);
+		offset_index_set_root(heap, index, nullptr);
+		heap_meta_free(heap, root);
 		}
 	return offset;
 	}
@@ -963,21 +2647,77 @@ if(child_count>1)
 if(root->locked)
 	return 0;
 offset_index_parent_group_t* parent_group=(offset_index_parent_group_t*)root;
-index->root=parent_group->children[0];
-heap_free_to_cache(heap, root);
+offset_index_set_root(heap, index, parent_group->children[0]);
+heap_meta_free(heap, root);
 return 0;
 }
 
 bool offset_index_lift_root(heap_t* heap, offset_index_t* index)
 {
-offset_index_parent_group_t* root=offset_index_parent_group_create_with_child(heap, index->root);
+offset_index_parent_group_t* root=offset_index_parent_group_create_with_child(heap, offset_index_get_root(heap, index));
 if(!root)
 	return false;
-index->root=(offset_index_group_t*)root;
+offset_index_set_root(heap, index, (offset_index_group_t*)root);
 return true;
 }
 
 
+//============
+// Block-List
+//============
+
+void block_list_insert(heap_t* heap, block_map_item_t* item, heap_offset_t offset)
+{
+heap_offset_t* links=block_list_get_links(heap, offset);
+heap_offset_t next=item->offset;
+links[0]=next;
+links[1]=0;
+if(next)
+	{
+	heap_offset_t* next_links=block_list_get_links(heap, next);
+	next_links[1]=offset;
+	}
+item->offset=offset;
+}
+
+heap_offset_t block_list_pop(heap_t* heap, block_map_item_t* item)
+{
+heap_offset_t offset=item->offset;
+assert(offset!=0);
+heap_offset_t* links=block_list_get_links(heap, offset);
+heap_offset_t next=links[0];
+if(next)
+	{
+	heap_offset_t* next_links=block_list_get_links(heap, next);
+	next_links[1]=0;
+	}
+item->offset=next;
+return offset;
+}
+
+void block_list_remove(heap_t* heap, block_map_item_t* item, heap_offset_t offset)
+{
+heap_offset_t* links=block_list_get_links(heap, offset);
+heap_offset_t next=links[0];
+heap_offset_t previous=links[1];
+if(previous)
+	{
+	heap_offset_t* previous_links=block_list_get_links(heap, previous);
+	previous_links[0]=next;
+	}
+else
+	{
+	assert(item->offset==offset);
+	item->offset=next;
+	}
+if(next)
+	{
+	heap_offset_t* next_links=block_list_get_links(heap, next);
+	next_links[1]=previous;
+	}
+}
+
+
 //=================
 // Block-Map-Group
 //=================
@@ -998,6 +2738,13 @@ group->locked=false;
 return added;
 }
 
+size_t block_map_group_find_size(block_map_group_t* group, size_t min_size)
+{
+if(group->level==0)
+	return block_map_item_group_find_size((block_map_item_group_t*)group, min_size);
+return block_map_parent_group_find_size((block_map_parent_group_t*)group, min_size);
+}
+
 bool block_map_group_get_block(heap_t* heap, block_map_group_t* group, size_t min_size, heap_block_info_t* info)
 {
 bool passive=group->locked;
@@ -1043,16 +2790,23 @@ bool exists=false;
 uint32_t pos=block_map_item_group_get_item_pos(group, info->size, &exists);
 if(!exists)
 	{
-	if(block_map_item_group_add_item(group, info, pos))
+	if(block_map_item_group_add_item(heap, group, info, pos))
 		return 1;
 	return 0;
 	}
 block_map_item_t* item=&group->items[pos];
+heap_offset_t offset=heap_get_relative_offset(heap, info->offset);
+if(block_list_is_listed(info->size))
+	{
+	block_list_insert(heap, item, offset);
+	block_map_item_group_cleanup(heap, group, info->size);
+	return 1;
+	}
 bool added=false;
 if(item->single)
 	{
-	offset_index_t index={ nullptr };
-	bool added=offset_index_add_offset(heap, &index, info->offset);
+	offset_index_t index={ 0 };
+	bool added=offset_index_add_offset(heap, &index, offset);
 	if(!added)
 		return -1;
 	if(item->offset)
@@ -1062,23 +2816,30 @@ if(item->single)
 	}
 else
 	{
-	if(!offset_index_add_offset(heap, &item->index, info->offset))
+	if(!offset_index_add_offset(heap, &item->index, offset))
 		return -1;
 	}
 block_map_item_group_cleanup(heap, group, info->size);
 return 1;
 }
 
-bool block_map_item_group_add_item(block_map_item_group_t* group, heap_block_info_t const* info, uint32_t pos)
+bool block_map_item_group_add_item(heap_t* heap, block_map_item_group_t* group, heap_block_info_t const* info, uint32_t pos)
 {
 uint32_t child_count=group->header.child_count;
-if(child_count==HEAP_GROUP_SIZE)
+if(child_count==BLOCK_MAP_ITEM_GROUP_SIZE)
 	return false;
 for(uint32_t u=child_count; u>pos; u--)
 	group->items[u]=group->items[u-1];
+heap_offset_t offset=heap_get_relative_offset(heap, info->offset);
 group->items[pos].size=info->size;
-group->items[pos].offset=info->offset;
+group->items[pos].offset=offset;
 group->items[pos].single=true;
+if(block_list_is_listed(info->size))
+	{
+	heap_offset_t* links=block_list_get_links(heap, offset);
+	links[0]=0;
+	links[1]=0;
+	}
 group->header.child_count++;
 return true;
 }
@@ -1106,7 +2867,7 @@ for(uint32_t pos=0; pos<child_count; )
 		}
 	if(item->offset&&!item->single)
 		{
-		size_t offset=offset_index_drop_root(heap, &item->index);
+		heap_offset_t offset=offset_index_drop_root(heap, &item->index);
 		if(offset)
 			{
 			item->offset=offset;
@@ -1128,13 +2889,22 @@ group->header.dirty=false;
 
 block_map_item_group_t* block_map_item_group_create(heap_t* heap)
 {
-block_map_item_group_t* group=(block_map_item_group_t*)heap_alloc_internal(heap, sizeof(block_map_item_group_t));
+block_map_item_group_t* group=(block_map_item_group_t*)heap_meta_alloc(heap);
 if(group==nullptr)
 	return nullptr;
 group->header.value=0;
 return group;
 }
 
+size_t block_map_item_group_find_size(block_map_item_group_t* group, size_t min_size)
+{
+bool exists=false;
+uint32_t pos=block_map_item_group_get_item_pos(group, min_size, &exists);
+if(pos>=group->header.child_count)
+	return 0;
+return group->items[pos].size;
+}
+
 bool block_map_item_group_get_block(heap_t* heap, block_map_item_group_t* group, size_t min_size, heap_block_info_t* info, bool passive)
 {
 uint32_t child_count=group->header.child_count;
@@ -1147,12 +2917,22 @@ assert(item->offset!=0);
 info->size=item->size;
 if(item->single)
 	{
-	info->offset=item->offset;
+	if(block_list_is_listed(item->size))
+		{
+		info->offset=heap_get_absolute_offset(heap, block_list_pop(heap, item));
+		if(item->offset)
+			return true;
+		}
+	else
+		{
+		info->offset=heap_get_absolute_offset(heap, item->offset);
+		}
 	block_map_item_group_remove_item_at(group, pos, passive);
 	return true;
 	}
-info->offset=offset_index_group_remove_last_offset(heap, item->index.root);
-size_t offset=offset_index_drop_root(heap, &item->index);
+offset_index_group_t* root=offset_index_get_root(heap, &item->index);
+info->offset=heap_get_absolute_offset(heap, offset_index_group_remove_last_offset(heap, root));
+heap_offset_t offset=offset_index_drop_root(heap, &item->index);
 if(offset)
 	{
 	item->offset=offset;
@@ -1221,15 +3001,26 @@ bool exists=false;
 uint32_t pos=block_map_item_group_get_item_pos(group, info->size, &exists);
 assert(exists);
 block_map_item_t* item=&group->items[pos];
+heap_offset_t offset=heap_get_relative_offset(heap, info->offset);
 if(item->single)
 	{
-	assert(item->offset==info->offset);
+	if(block_list_is_listed(item->size))
+		{
+		block_list_remove(heap, item, offset);
+		if(item->offset)
+			return;
+		}
+	else
+		{
+		assert(item->offset==offset);
+		}
 	block_map_item_group_remove_item_at(group, pos, false);
 	return;
 	}
 assert(item->offset);
-offset_index_group_remove_offset(heap, item->index.root, info->offset);
-size_t offset=offset_index_drop_root(heap, &item->index);
+offset_index_group_t* root=offset_index_get_root(heap, &item->index);
+offset_index_group_remove_offset(heap, root, offset);
+offset=offset_index_drop_root(heap, &item->index);
 if(offset)
 	{
 	item->offset=offset;
@@ -1239,12 +3030,12 @@ if(!item->offset)
 	block_map_item_group_remove_item_at(group, pos, false);
 }
 
-size_t block_map_item_group_remove_item_at(block_map_item_group_t* group, uint32_t pos, bool passive)
+heap_offset_t block_map_item_group_remove_item_at(block_map_item_group_t* group, uint32_t pos, bool passive)
 {
 uint32_t child_count=group->header.child_count;
 assert(pos<child_count);
 block_map_item_t* item=&group->items[pos];
-size_t offset=item->offset;
+heap_offset_t offset=item->offset;
 if(passive)
 	{
 	item->offset=0;
@@ -1276,7 +3067,7 @@ group->header.child_count-=count;;
 int16_t block_map_parent_group_add_block(heap_t* heap, block_map_parent_group_t* group, heap_block_info_t const* info, bool again)
 {
 int16_t added=block_map_parent_group_add_block_internal(heap, group, info, again);
-cluster_parent_group_cleanup(heap, (cluster_parent_group_t*)group);
+cluster_parent_group_cleanup(heap, (cluster_parent_group_t*)group, BLOCK_MAP_PARENT_GROUP_SIZE);
 if(added==1)
 	block_map_parent_group_update_bounds(group);
 return added;
@@ -1291,6 +3082,7 @@ if(!again)
 	for(uint32_t u=0; u<count; u++)
 		{
 		int16_t added=block_map_group_add_block(heap, group->children[pos+u], info, false);
+		block_map_parent_group_update_child(group, pos+u);
 		if(added!=0)
 			return added;
 		}
@@ -1300,6 +3092,7 @@ if(!again)
 		for(uint32_t u=0; u<count; u++)
 			{
 			int16_t added=block_map_group_add_block(heap, group->children[pos+u], info, false);
+			block_map_parent_group_update_child(group, pos+u);
 			if(added!=0)
 				return added;
 			}
@@ -1311,33 +3104,35 @@ count=block_map_parent_group_get_item_pos(group, info->size, &pos, false);
 for(uint32_t u=0; u<count; u++)
 	{
 	int16_t added=block_map_group_add_block(heap, group->children[pos+u], info, true);
+	block_map_parent_group_update_child(group, pos+u);
 	if(added!=0)
 		return added;
 	}
 return -1;
 }
 
-void block_map_parent_group_append_groups(block_map_parent_group_t* group, block_map_group_t* const* append, uint32_t count)
+void block_map_parent_group_append_groups(block_map_parent_group_t* group, block_map_group_t* const* append, heap_offset_t const* first_sizes, heap_offset_t const* last_sizes, uint32_t count)
 {
-cluster_parent_group_append_groups((cluster_parent_group_t*)group, (cluster_group_t* const*)append, count);
+cluster_parent_group_append_groups((cluster_parent_group_t*)group, BLOCK_MAP_PARENT_GROUP_SIZE, (cluster_group_t* const*)append, first_sizes, last_sizes, count);
 block_map_parent_group_update_bounds(group);
 }
 
 bool block_map_parent_group_combine_child(heap_t* heap, block_map_parent_group_t* group, uint32_t pos)
 {
+uint32_t capacity=block_map_parent_group_get_child_capacity(group);
 uint32_t count=group->children[pos]->child_count;
 if(count==0)
 	{
-	cluster_parent_group_remove_group(heap, (cluster_parent_group_t*)group, pos);
+	cluster_parent_group_remove_group(heap, (cluster_parent_group_t*)group, BLOCK_MAP_PARENT_GROUP_SIZE, pos);
 	return true;
 	}
 if(pos>0)
 	{
 	uint32_t before=group->children[pos-1]->child_count;
-	if(count+before<=HEAP_GROUP_SIZE)
+	if(count+before<=capacity)
 		{
 		block_map_parent_group_move_children(group, pos, pos-1, count);
-		cluster_parent_group_remove_group(heap, (cluster_parent_group_t*)group, pos);
+		cluster_parent_group_remove_group(heap, (cluster_parent_group_t*)group, BLOCK_MAP_PARENT_GROUP_SIZE, pos);
 		return true;
 		}
 	}
@@ -1345,10 +3140,10 @@ uint32_t child_count=group->header.child_count;
 if(pos+1<child_count)
 	{
 	uint32_t after=group->children[pos+1]->child_count;
-	if(count+after<=HEAP_GROUP_SIZE)
+	if(count+after<=capacity)
 		{
 		block_map_parent_group_move_children(group, pos+1, pos, after);
-		cluster_parent_group_remove_group(heap, (cluster_parent_group_t*)group, pos+1);
+		cluster_parent_group_remove_group(heap, (cluster_parent_group_t*)group, BLOCK_MAP_PARENT_GROUP_SIZE, pos+1);
 		return true;
 		}
 	}
@@ -1357,7 +3152,7 @@ return false;
 
 block_map_parent_group_t* block_map_parent_group_create(heap_t* heap, uint32_t level)
 {
-block_map_parent_group_t* group=(block_map_parent_group_t*)heap_alloc_internal(heap, sizeof(block_map_parent_group_t));
+block_map_parent_group_t* group=(block_map_parent_group_t*)heap_meta_alloc(heap);
 if(group==nullptr)
 	return nullptr;
 group->header.value=0;
@@ -1369,7 +3164,7 @@ return group;
 
 block_map_parent_group_t* block_map_parent_group_create_with_child(heap_t* heap, block_map_group_t* child)
 {
-block_map_parent_group_t* group=(block_map_parent_group_t*)heap_alloc_internal(heap, sizeof(block_map_parent_group_t));
+block_map_parent_group_t* group=(block_map_parent_group_t*)heap_meta_alloc(heap);
 if(group==nullptr)
 	return nullptr;
 group->header.value=0;
@@ -1377,10 +3172,26 @@ group->header.child_count=1;
 group->header.level=child->level+1;
 group->first_size=block_map_group_get_first_size(child);
 group->last_size=block_map_group_get_last_size(child);
+group->first_sizes[0]=group->first_size;
+group->last_sizes[0]=group->last_size;
 group->children[0]=child;
 return group;
 }
 
+size_t block_map_parent_group_find_size(block_map_parent_group_t* group, size_t min_size)
+{
+uint32_t child_count=group->header.child_count;
+for(uint32_t pos=0; pos<child_count; pos++)
+	{
+	if(group->last_sizes[pos]<min_size)
+		continue;
+	size_t size=block_map_group_find_size(group->children[pos], min_size);
+	if(size)
+		return size;
+	}
+return 0;
+}
+
 bool block_map_parent_group_get_block(heap_t* heap, block_map_parent_group_t* group, size_t min_size, heap_block_info_t* info, bool passive)
 {
 uint32_t pos=0;
@@ -1390,6 +3201,7 @@ if(count==2)
 	pos++;
 if(!block_map_group_get_block(heap, group->children[pos], min_size, info))
 	return false;
+block_map_parent_group_update_child(group, pos);
 if(passive)
 	{
 	group->header.dirty=true;
@@ -1408,12 +3220,13 @@ uint32_t child_count=group->header.child_count;
 uint32_t pos=0;
 for(; pos<child_count; pos++)
 	{
-	size_t first_size=block_map_group_get_first_size(group->children[pos]);
+	size_t first_size=group->first_sizes[pos];
 	if(size<first_size)
 		break;
-	size_t last_size=block_map_group_get_last_size(group->children[pos]);
+	size_t last_size=group->last_sizes[pos];
 	if(size>last_size)
 		continue;
+	__builtin_prefetch(group->children[pos]);
 	*pos_ptr=pos;
 	return 1;
 	}
@@ -1437,9 +3250,9 @@ pos--;
 return 2;
 }
 
-void block_map_parent_group_insert_groups(block_map_parent_group_t* group, uint32_t at, block_map_group_t* const* insert, uint32_t count)
+void block_map_parent_group_insert_groups(block_map_parent_group_t* group, uint32_t at, block_map_group_t* const* insert, heap_offset_t const* first_sizes, heap_offset_t const* last_sizes, uint32_t count)
 {
-cluster_parent_group_insert_groups((cluster_parent_group_t*)group, at, (cluster_group_t* const*)insert, count);
+cluster_parent_group_insert_groups((cluster_parent_group_t*)group, BLOCK_MAP_PARENT_GROUP_SIZE, at, (cluster_group_t* const*)insert, first_sizes, last_sizes, count);
 block_map_parent_group_update_bounds(group);
 }
 
@@ -1452,13 +3265,13 @@ if(level>1)
 	block_map_parent_group_t* dst=(block_map_parent_group_t*)group->children[to];
 	if(from>to)
 		{
-		block_map_parent_group_append_groups(dst, src->children, count);
+		block_map_parent_group_append_groups(dst, src->children, src->first_sizes, src->last_sizes, count);
 		block_map_parent_group_remove_groups(src, 0, count);
 		}
 	else
 		{
 		uint32_t src_count=src->header.child_count;
-		block_map_parent_group_insert_groups(dst, 0, &src->children[src_count-count], count);
+		block_map_parent_group_insert_groups(dst, 0, &src->children[src_count-count], &src->first_sizes[src_count-count], &src->last_sizes[src_count-count], count);
 		block_map_parent_group_remove_groups(src, src_count-count, count);
 		}
 	}
@@ -1478,6 +3291,8 @@ else
 		block_map_item_group_remove_items(src, src_count-count, count);
 		}
 	}
+block_map_parent_group_update_child(group, from);
+block_map_parent_group_update_child(group, to);
 }
 
 void block_map_parent_group_move_empty_slot(block_map_parent_group_t* group, uint32_t from, uint32_t to)
@@ -1500,19 +3315,21 @@ uint32_t pos=0;
 uint32_t count=block_map_parent_group_get_item_pos(group, info->size, &pos, true);
 assert(count==1);
 block_map_group_remove_block(heap, group->children[pos], info);
+block_map_parent_group_update_child(group, pos);
 block_map_parent_group_combine_child(heap, group, pos);
 block_map_parent_group_update_bounds(group);
 }
 
 void block_map_parent_group_remove_groups(block_map_parent_group_t* group, uint32_t at, uint32_t count)
 {
-cluster_parent_group_remove_groups((cluster_parent_group_t*)group, at, count);
+cluster_parent_group_remove_groups((cluster_parent_group_t*)group, BLOCK_MAP_PARENT_GROUP_SIZE, at, count);
 block_map_parent_group_update_bounds(group);
 }
 
 bool block_map_parent_group_shift_children(block_map_parent_group_t* group, uint32_t at, uint32_t count)
 {
-int16_t space=cluster_parent_group_get_nearest_space((cluster_parent_group_t*)group, at);
+uint32_t capacity=block_map_parent_group_get_child_capacity(group);
+int16_t space=cluster_parent_group_get_nearest_space((cluster_parent_group_t*)group, BLOCK_MAP_PARENT_GROUP_SIZE, at, capacity);
 if(space<0)
 	return false;
 if(count>1&&space>at)
@@ -1524,7 +3341,7 @@ return true;
 bool block_map_parent_group_split_child(heap_t* heap, block_map_parent_group_t* group, uint32_t at)
 {
 uint32_t child_count=group->header.child_count;
-if(child_count==HEAP_GROUP_SIZE)
+if(child_count==BLOCK_MAP_PARENT_GROUP_SIZE)
 	return false;
 block_map_group_t* child=nullptr;
 uint32_t level=group->header.level;
@@ -1538,10 +3355,8 @@ else
 	}
 if(!child)
 	return false;
-for(uint32_t u=child_count; u>at+1; u--)
-	group->children[u]=group->children[u-1];
-group->children[at+1]=child;
-group->header.child_count++;
+heap_offset_t bounds=0;
+block_map_parent_group_insert_groups(group, at+1, &child, &bounds, &bounds, 1);
 block_map_parent_group_move_children(group, at, at+1, 1);
 return true;
 }
@@ -1557,18 +3372,25 @@ if(child_count==0)
 	}
 for(uint32_t pos=0; pos<child_count; pos++)
 	{
-	group->first_size=block_map_group_get_first_size(group->children[pos]);
+	group->first_size=group->first_sizes[pos];
 	if(group->first_size!=0)
 		break;
 	}
 for(uint32_t pos=child_count; pos>0; pos--)
 	{
-	group->last_size=block_map_group_get_last_size(group->children[pos-1]);
+	group->last_size=group->last_sizes[pos-1];
 	if(group->last_size!=0)
 		break;
 	}
 }
 
+void block_map_parent_group_update_child(block_map_parent_group_t* group, uint32_t pos)
+{
+block_map_group_t* child=group->children[pos];
+group->first_sizes[pos]=block_map_group_get_first_size(child);
+group->last_sizes[pos]=block_map_group_get_last_size(child);
+}
+
 
 //===========
 // Block-Map
@@ -1578,6 +3400,7 @@ bool block_map_add_block(heap_t* heap, block_map_t* map, heap_block_info_t const
 {
 assert(info->offset>=(size_t)heap+sizeof(heap_t));
 assert(info->offset<(size_t)heap+heap->used);
+heap->work++;
 if(!map->root)
 	{
 	map->root=(block_map_group_t*)block_map_item_group_create(heap);
@@ -1585,16 +3408,23 @@ if(!map->root)
 		return false;
 	}
 int16_t added=block_map_group_add_block(heap, map->root, info, false);
-if(added!=0)
+if(added==0)
 	{
-	block_map_drop_root(heap, map);
-	return (added==1);
+	if(!block_map_lift_root(heap, map))
+		return false;
+	added=block_map_group_add_block(heap, map->root, info, true);
 	}
-if(!block_map_lift_root(heap, map))
-	return false;
-added=block_map_group_add_block(heap, map->root, info, true);
 block_map_drop_root(heap, map);
-return (added==1);
+if(added!=1)
+	return false;
+block_map_add_class(map, info->size);
+return true;
+}
+
+void block_map_add_class(block_map_t* map, size_t size)
+{
+map->classes|=(size_t)1<<block_map_get_class(size);
+map->count++;
 }
 
 bool block_map_drop_root(heap_t* heap, block_map_t* map)
@@ -1610,19 +3440,25 @@ if(child_count>1)
 	return false;
 block_map_parent_group_t* parent_group=(block_map_parent_group_t*)root;
 map->root=parent_group->children[0];
-heap_free_to_cache(heap, root);
+heap_meta_free(heap, root);
 return true;
 }
 
 bool block_map_get_block(heap_t* heap, block_map_t* map, size_t min_size, heap_block_info_t* info)
 {
-block_map_group_t* root=map->root;
-if(!root)
+heap->work++;
+uint32_t cls=block_map_get_class(min_size);
+size_t classes=map->classes>>cls;
+if(!classes)
 	return false;
+if(!(classes&1))
+	min_size=(size_t)1<<(cls+__builtin_ctzll((unsigned long long)classes));
+block_map_group_t* root=map->root;
 if(!block_map_group_get_block(heap, root, min_size, info))
 	return false;
 if(!root->locked)
 	block_map_drop_root(heap, map);
+block_map_remove_class(map, info->size);
 return true;
 }
 
@@ -1637,6 +3473,19 @@ return true;
 
 void block_map_remove_block(heap_t* heap, block_map_t* map, heap_block_info_t const* info)
 {
+heap->work++;
 block_map_group_remove_block(heap, map->root, info);
 block_map_drop_root(heap, map);
+block_map_remove_class(map, info->size);
+}
+
+void block_map_remove_class(block_map_t* map, size_t size)
+{
+assert(map->count>0);
+map->count--;
+uint32_t cls=block_map_get_class(size);
+size_t class_size=(size_t)1<<cls;
+size_t next_size=block_map_group_find_size(map->root, class_size);
+if(next_size==0||next_size>=2*class_size)
+	map->classes&=~class_size;
 }
@@ -27,14 +27,95 @@ extern "C" {
 // Settings
 //==========
 
+#ifndef HEAP_BLOCK_LISTS
+#define HEAP_BLOCK_LISTS 1
+#endif
+
+#ifndef HEAP_COMPACT
+#define HEAP_COMPACT 0
+#endif
+
+#ifndef HEAP_DEFERRED_FREE
+#define HEAP_DEFERRED_FREE 0
+#endif
+
+#ifndef HEAP_DEFERRED_THRESHOLD
+#define HEAP_DEFERRED_THRESHOLD 25
+#endif
+
+#ifndef HEAP_GROUP_SIZE
 #define HEAP_GROUP_SIZE 10
+#endif
+
+#ifndef BLOCK_MAP_ITEM_GROUP_SIZE
+#define BLOCK_MAP_ITEM_GROUP_SIZE HEAP_GROUP_SIZE
+#endif
+
+#ifndef BLOCK_MAP_PARENT_GROUP_SIZE
+#define BLOCK_MAP_PARENT_GROUP_SIZE HEAP_GROUP_SIZE
+#endif
+
+#ifndef OFFSET_INDEX_ITEM_GROUP_SIZE
+#define OFFSET_INDEX_ITEM_GROUP_SIZE HEAP_GROUP_SIZE
+#endif
+
+#ifndef OFFSET_INDEX_PARENT_GROUP_SIZE
+#define OFFSET_INDEX_PARENT_GROUP_SIZE HEAP_GROUP_SIZE
+#endif
+
+#ifndef HEAP_HOT_LISTS
+#define HEAP_HOT_LISTS 0
+#endif
+
+#ifndef HEAP_LARGE_THRESHOLD
+#define HEAP_LARGE_THRESHOLD 0
+#endif
+
+#ifndef HEAP_SITES
+#define HEAP_SITES 0
+#endif
+
+#ifndef HEAP_THREADSAFE
+#define HEAP_THREADSAFE 0
+#endif
+
+#ifndef HEAP_WORK_BUDGET
+#define HEAP_WORK_BUDGET 8
+#endif
+
+#define HEAP_CACHE_LINE 64
+#define HEAP_HANDLE_COUNT_MIN 16
+#define HEAP_HOT_DEPTH 8
+#define HEAP_HOT_HITS_MAX 64
+#define HEAP_HOT_THRESHOLD 8
+#define HEAP_LOCK_BUCKETS 24
+#define HEAP_LOCK_SPIN_MAX 1000
+#define HEAP_META_RESERVE 16
+#define HEAP_META_RESERVE_MIN 4
+#define HEAP_META_SHARE 64
+#define HEAP_PAGE_SIZE 4096
+#define HEAP_PENDING_BINS 16
+#define HEAP_SITE_CHUNK 4096
+#define HEAP_SITE_HITS_MAX 64
+#define HEAP_SITE_THRESHOLD 16
+#define HEAP_SPARE_CLASSES 8
+#define HEAP_SPARE_DEPTH 4
+#define HEAP_SPARE_SIZE_MIN (2*sizeof(size_t))
+#define HEAP_WORK_FREE 3
 
 
 //===========
 // Alignment
 //===========
 
+#if HEAP_COMPACT
+typedef uint32_t heap_offset_t;
+#else
+typedef size_t heap_offset_t;
+#endif
+
 #define BLOCK_SIZE_MIN (4*sizeof(size_t))
+#define OFFSET_BITS (sizeof(heap_offset_t)*8)
 #define SIZE_BITS (sizeof(size_t)*8)
 
 static inline size_t align_down(size_t value, size_t align)
@@ -52,6 +133,36 @@ return value+(align-value%align)%align;
 // Heap
 //======
 
+typedef struct
+{
+size_t size;
+size_t hits;
+size_t first;
+size_t count;
+}heap_hot_list_t;
+
+typedef struct
+{
+size_t acquisitions;
+size_t contended;
+size_t waits[HEAP_LOCK_BUCKETS];
+}heap_lock_stats_t;
+
+typedef struct
+{
+uint32_t state;
+uint32_t spin;
+heap_lock_stats_t stats;
+}heap_lock_t;
+
+typedef struct
+{
+size_t address;
+size_t hits;
+size_t chunk;
+size_t start;
+}heap_site_t;
+
 typedef struct
 {
 size_t free;
@@ -59,15 +170,96 @@ size_t used;
 size_t size;
 size_t free_block;
 size_t map_free;
+size_t map_classes;
+size_t map_count;
+size_t handles;
+size_t handle_count;
+size_t handle_free;
+size_t handle_used;
+size_t compact_offset;
+size_t meta_free;
+size_t meta_extra;
+size_t meta_count;
+size_t meta_reserve;
+size_t meta_end;
+bool meta_failed;
+size_t work;
+size_t work_max;
+size_t miss_work_max;
+size_t large;
+size_t large_size;
+size_t pending_bin;
+size_t pending_count;
+size_t pending_size;
+size_t pending[HEAP_PENDING_BINS];
+uint64_t spare[HEAP_SPARE_CLASSES];
+size_t spare_count[HEAP_SPARE_CLASSES];
+#if HEAP_HOT_LISTS
+size_t hot_age;
+heap_hot_list_t hot_lists[HEAP_HOT_LISTS];
+#endif
+#if HEAP_SITES
+size_t site_age;
+heap_site_t sites[HEAP_SITES];
+#endif
+#if HEAP_THREADSAFE
+heap_lock_t lock;
+#endif
 }heap_t;
 
+#define HEAP_ALLOC_LONG_LIVED 1
+#define HEAP_ALLOC_SHORT_LIVED 2
+#define HEAP_ALLOC_CACHE_LINE 4
+
+typedef size_t heap_handle_t;
+
+typedef struct
+{
+size_t const* sizes;
+size_t size_count;
+size_t groups;
+size_t handles;
+bool lock;
+}heap_profile_t;
+
+static inline size_t heap_get_absolute_offset(heap_t* heap, heap_offset_t offset)
+{
+return (size_t)heap+offset*sizeof(size_t);
+}
+
+static inline heap_offset_t heap_get_relative_offset(heap_t* heap, size_t offset)
+{
+return (heap_offset_t)((offset-(size_t)heap)/sizeof(size_t));
+}
+
 void* heap_alloc(heap_t* heap, size_t size);
 void* heap_alloc_aligned(heap_t* heap, size_t size, size_t align);
+void* heap_alloc_ex(heap_t* heap, size_t size, uint32_t flags);
+heap_handle_t heap_alloc_movable(heap_t* heap, size_t size);
 size_t heap_available(heap_t* heap);
+size_t heap_compact(heap_t* heap, size_t budget);
 heap_t* heap_create(size_t offset, size_t size);
 void heap_free(heap_t* heap, void* buffer);
+void heap_free_batch(heap_t* heap, void* const* bufs, size_t count);
+void heap_free_movable(heap_t* heap, heap_handle_t handle);
+size_t heap_get_fragmentation(heap_t* heap);
+size_t heap_get_free_block_count(heap_t* heap);
+size_t heap_get_large_size(heap_t* heap);
 size_t heap_get_largest_free_block(heap_t* heap);
+void heap_get_lock_stats(heap_t* heap, heap_lock_stats_t* stats);
+size_t heap_get_miss_work_max(heap_t* heap);
+size_t heap_get_work_max(heap_t* heap);
+size_t heap_maintain(heap_t* heap, size_t budget);
+void* heap_pin(heap_t* heap, heap_handle_t handle);
+bool heap_prepare(heap_t* heap, heap_profile_t const* profile);
+void* heap_realloc(heap_t* heap, void* buf, size_t size);
+void heap_release_range(heap_t* heap, size_t offset, size_t size);
+void heap_replenish(heap_t* heap);
 void heap_reserve(heap_t* handle, size_t offset, size_t size);
+bool heap_reserve_range(heap_t* heap, size_t offset, size_t size);
+void* heap_try_alloc(heap_t* heap, size_t size);
+bool heap_try_free(heap_t* heap, void* buf);
+void heap_unpin(heap_t* heap, heap_handle_t handle);
 
 
 //===============
@@ -75,12 +267,42 @@ void heap_reserve(heap_t* handle, size_t offset, size_t size);
 //===============
 
 void* heap_alloc_from_cache(heap_t* heap, size_t size);
+void* heap_alloc_from_caller(heap_t* heap, size_t size, size_t caller);
 void* heap_alloc_from_foot(heap_t* heap, size_t size);
-void* heap_alloc_from_map(heap_t* heap, size_t size);
+void* heap_alloc_from_map(heap_t* heap, size_t size, bool tail);
+void* heap_alloc_from_pending(heap_t* heap, size_t size, bool tail);
 void* heap_alloc_internal(heap_t* heap, size_t size);
+void* heap_alloc_internal_isolated(heap_t* heap, size_t size);
+void* heap_alloc_internal_short(heap_t* heap, size_t size);
 void heap_free_cache(heap_t* heap);
+void heap_free_internal(heap_t* heap, void* buf);
 void heap_free_to_cache(heap_t* heap, void* buf);
 void heap_free_to_map(heap_t* heap, void* buf);
+void* heap_realloc_aligned(heap_t* heap, void* buf, size_t size);
+
+
+//============
+// Heap-Arena
+//============
+
+typedef struct
+{
+heap_t* heap;
+size_t parent;
+size_t children;
+size_t previous;
+size_t next;
+size_t chunk_size;
+size_t chunks;
+size_t offset;
+size_t end;
+}heap_arena_t;
+
+void* heap_arena_alloc(heap_arena_t* arena, size_t size, size_t align);
+heap_arena_t* heap_arena_create(heap_t* heap, size_t chunk_size);
+heap_arena_t* heap_arena_create_nested(heap_arena_t* parent, size_t chunk_size);
+void heap_arena_destroy(heap_arena_t* arena);
+void heap_arena_reset(heap_arena_t* arena);
 
 
 //============
@@ -94,7 +316,9 @@ union
 	{
 	struct
 		{
-		size_t size: SIZE_BITS-2;
+		size_t size: SIZE_BITS-4;
+		size_t previous_free: 1;
+		size_t movable: 1;
 		size_t aligned: 1;
 		size_t free: 1;
 		};
@@ -111,7 +335,7 @@ heap_block_info_t next;
 
 static inline size_t heap_block_calc_size(size_t size)
 {
-return align_up(size, sizeof(size_t))+2*sizeof(size_t);
+return align_up(size, sizeof(size_t))+sizeof(size_t);
 }
 
 static inline size_t heap_block_get_offset(void* ptr)
@@ -124,9 +348,183 @@ static inline void* heap_block_get_pointer(size_t offset)
 return (void*)(offset+sizeof(size_t));
 }
 
+void* heap_block_align(void* buf, size_t align);
 void heap_block_get_chain(heap_t* heap, void* ptr, heap_block_chain_t* info);
 void heap_block_get_info(heap_t* heap, void* ptr, heap_block_info_t* info);
 void* heap_block_init(heap_t* heap, heap_block_info_t const* info);
+void heap_block_set_previous_free(heap_t* heap, size_t offset, bool free);
+
+
+//=============
+// Heap-Handle
+//=============
+
+typedef struct
+{
+size_t offset;
+union
+	{
+	size_t pins;
+	size_t next;
+	};
+}heap_handle_entry_t;
+
+heap_handle_t heap_handle_create(heap_t* heap, size_t offset);
+heap_handle_entry_t* heap_handle_get_entry(heap_t* heap, heap_handle_t handle);
+bool heap_handle_grow(heap_t* heap);
+void heap_handle_release(heap_t* heap, heap_handle_t handle);
+
+
+//===============
+// Heap-Hot-List
+//===============
+
+void heap_hot_list_age(heap_t* heap);
+void* heap_hot_list_alloc(heap_t* heap, size_t size);
+void heap_hot_list_flush(heap_t* heap, heap_hot_list_t* list);
+void heap_hot_list_flush_all(heap_t* heap);
+bool heap_hot_list_free(heap_t* heap, void* buf);
+bool heap_hot_list_prepare(heap_t* heap, size_t size);
+
+static inline heap_hot_list_t* heap_hot_list_get(heap_t* heap, size_t size)
+{
+#if HEAP_HOT_LISTS
+return &heap->hot_lists[(size/sizeof(size_t))%HEAP_HOT_LISTS];
+#else
+(void)heap;
+(void)size;
+return nullptr;
+#endif
+}
+
+//============
+// Heap-Large
+//============
+
+typedef struct
+{
+size_t previous;
+size_t next;
+size_t size;
+}heap_large_t;
+
+void* heap_large_alloc(heap_t* heap, size_t size);
+bool heap_large_free(heap_t* heap, void* buf);
+
+static inline bool heap_large_is_mapped(heap_t* heap, void* buf)
+{
+#if HEAP_LARGE_THRESHOLD
+size_t offset=(size_t)buf;
+return offset<(size_t)heap||offset>=(size_t)heap+heap->size;
+#else
+(void)heap;
+(void)buf;
+return false;
+#endif
+}
+
+void heap_large_link(heap_t* heap, heap_large_t* large);
+void* heap_large_realloc(heap_t* heap, void* buf, size_t size);
+void heap_large_unlink(heap_t* heap, heap_large_t* large);
+
+
+//===========
+// Heap-Lock
+//===========
+
+void heap_lock_acquire(heap_lock_t* lock);
+void heap_lock_init(heap_lock_t* lock);
+void heap_lock_release(heap_lock_t* lock);
+
+static inline void heap_lock(heap_t* heap)
+{
+#if HEAP_THREADSAFE
+heap_lock_acquire(&heap->lock);
+#else
+(void)heap;
+#endif
+}
+
+static inline void heap_unlock(heap_t* heap)
+{
+#if HEAP_THREADSAFE
+heap_lock_release(&heap->lock);
+#else
+(void)heap;
+#endif
+}
+
+
+//===========
+// Heap-Meta
+//===========
+
+void* heap_meta_alloc(heap_t* heap);
+void heap_meta_free(heap_t* heap, void* buf);
+size_t heap_meta_get_slot_size();
+bool heap_meta_grow(heap_t* heap);
+void heap_meta_init(heap_t* heap);
+bool heap_meta_reserve(heap_t* heap);
+
+
+//==============
+// Heap-Pending
+//==============
+
+void* heap_pending_alloc(heap_t* heap, size_t size);
+size_t heap_pending_flush(heap_t* heap, size_t budget);
+void heap_pending_free(heap_t* heap, void* buf);
+
+static inline size_t* heap_pending_get_bin(heap_t* heap, size_t size)
+{
+return &heap->pending[(size/sizeof(size_t))%HEAP_PENDING_BINS];
+}
+
+bool heap_pending_prepare(heap_t* heap, size_t size);
+
+
+//===========
+// Heap-Site
+//===========
+
+void heap_site_age(heap_t* heap);
+void* heap_site_alloc(heap_t* heap, size_t address, size_t size);
+void* heap_site_carve(heap_t* heap, heap_site_t* site, size_t size);
+
+static inline heap_site_t* heap_site_get(heap_t* heap, size_t address)
+{
+#if HEAP_SITES
+return &heap->sites[(address^(address>>12))%HEAP_SITES];
+#else
+(void)heap;
+(void)address;
+return nullptr;
+#endif
+}
+
+bool heap_site_is_empty(heap_t* heap, heap_site_t* site);
+void heap_site_release(heap_t* heap, heap_site_t* site);
+void heap_site_release_all(heap_t* heap);
+
+
+//============
+// Heap-Spare
+//============
+
+static inline uint32_t heap_spare_get_class(size_t size)
+{
+size_t slots=size/HEAP_SPARE_SIZE_MIN;
+uint32_t cls=(uint32_t)(63-__builtin_clzll((unsigned long long)slots));
+return cls<HEAP_SPARE_CLASSES? cls: HEAP_SPARE_CLASSES;
+}
+
+static inline size_t heap_spare_get_size(uint32_t cls)
+{
+return HEAP_SPARE_SIZE_MIN<<cls;
+}
+
+void* heap_spare_pop(heap_t* heap, uint32_t cls);
+void heap_spare_push(heap_t* heap, uint32_t cls, void* buf);
 
 
 //===============
@@ -156,17 +554,33 @@ union
 typedef struct
 {
 cluster_group_t header;
-size_t first;
-size_t last;
-cluster_group_t* children[HEAP_GROUP_SIZE];
+heap_offset_t first;
+heap_offset_t last;
 }cluster_parent_group_t;
 
-void cluster_parent_group_append_groups(cluster_parent_group_t* group, cluster_group_t* const* append, uint32_t count);
-void cluster_parent_group_cleanup(heap_t* heap, cluster_parent_group_t* group);
-int16_t cluster_parent_group_get_nearest_space(cluster_parent_group_t* group, int16_t pos);
-void cluster_parent_group_insert_groups(cluster_parent_group_t* group, uint32_t at, cluster_group_t* const* insert, uint32_t count);
-void cluster_parent_group_remove_group(heap_t* heap, cluster_parent_group_t* group, uint32_t at);
-void cluster_parent_group_remove_groups(cluster_parent_group_t* group, uint32_t at, uint32_t count);
+void cluster_parent_group_append_groups(cluster_parent_group_t* group, uint32_t group_size, cluster_group_t* const* append, heap_offset_t const* firsts, heap_offset_t const* lasts, uint32_t count);
+void cluster_parent_group_cleanup(heap_t* heap, cluster_parent_group_t* group, uint32_t group_size);
+
+static inline heap_offset_t* cluster_parent_group_get_firsts(cluster_parent_group_t* group)
+{
+return (heap_offset_t*)((size_t)group+sizeof(cluster_parent_group_t));
+}
+
+static inline heap_offset_t* cluster_parent_group_get_lasts(cluster_parent_group_t* group, uint32_t group_size)
+{
+return cluster_parent_group_get_firsts(group)+group_size;
+}
+
+static inline cluster_group_t** cluster_parent_group_get_children(cluster_parent_group_t* group, uint32_t group_size)
+{
+size_t offset=(size_t)(cluster_parent_group_get_lasts(group, group_size)+group_size);
+return (cluster_group_t**)align_up(offset, sizeof(cluster_group_t*));
+}
+
+int16_t cluster_parent_group_get_nearest_space(cluster_parent_group_t* group, uint32_t group_size, int16_t pos, uint32_t capacity);
+void cluster_parent_group_insert_groups(cluster_parent_group_t* group, uint32_t group_size, uint32_t at, cluster_group_t* const* insert, heap_offset_t const* firsts, heap_offset_t const* lasts, uint32_t count);
+void cluster_parent_group_remove_group(heap_t* heap, cluster_parent_group_t* group, uint32_t group_size, uint32_t at);
+void cluster_parent_group_remove_groups(cluster_parent_group_t* group, uint32_t group_size, uint32_t at, uint32_t count);
 
 
 //====================
@@ -175,11 +589,11 @@ void cluster_parent_group_remove_groups(cluster_parent_group_t* group, uint32_t
 
 typedef cluster_group_t offset_index_group_t;
 
-bool offset_index_group_add_offset(heap_t* heap, offset_index_group_t* group, size_t offset, bool again);
-size_t offset_index_group_get_first_offset(offset_index_group_t* group);
-size_t offset_index_group_get_last_offset(offset_index_group_t* group);
-size_t offset_index_group_remove_last_offset(heap_t* heap, offset_index_group_t* group);
-void offset_index_group_remove_offset(heap_t* heap, offset_index_group_t* group, size_t offset);
+bool offset_index_group_add_offset(heap_t* heap, offset_index_group_t* group, heap_offset_t offset, bool again);
+heap_offset_t offset_index_group_get_first_offset(offset_index_group_t* group);
+heap_offset_t offset_index_group_get_last_offset(offset_index_group_t* group);
+heap_offset_t offset_index_group_remove_last_offset(heap_t* heap, offset_index_group_t* group);
+void offset_index_group_remove_offset(heap_t* heap, offset_index_group_t* group, heap_offset_t offset);
 
 
 //=========================
@@ -189,20 +603,20 @@ void offset_index_group_remove_offset(heap_t* heap, offset_index_group_t* group,
 typedef struct
 {
 cluster_group_t header;
-size_t items[HEAP_GROUP_SIZE];
+heap_offset_t items[OFFSET_INDEX_ITEM_GROUP_SIZE];
 }offset_index_item_group_t;
 
-bool offset_index_item_group_add_offset(offset_index_item_group_t* group, size_t offset);
-void offset_index_item_group_append_items(offset_index_item_group_t* group, size_t const* append, uint32_t count);
+bool offset_index_item_group_add_offset(offset_index_item_group_t* group, heap_offset_t offset);
+void offset_index_item_group_append_items(offset_index_item_group_t* group, heap_offset_t const* append, uint32_t count);
 offset_index_item_group_t* offset_index_item_group_create(heap_t* heap);
-size_t offset_index_item_group_get_first_offset(offset_index_item_group_t* group);
-uint32_t offset_index_item_group_get_item_pos(offset_index_item_group_t* group, size_t offset, bool* exists_ptr);
-size_t offset_index_item_group_get_last_offset(offset_index_item_group_t* group);
-void offset_index_item_group_insert_items(offset_index_item_group_t* group, uint32_t pos, size_t const* insert, uint32_t count);
-size_t offset_index_item_group_remove_item(offset_index_item_group_t* group, uint32_t pos);
+heap_offset_t offset_index_item_group_get_first_offset(offset_index_item_group_t* group);
+uint32_t offset_index_item_group_get_item_pos(offset_index_item_group_t* group, heap_offset_t offset, bool* exists_ptr);
+heap_offset_t offset_index_item_group_get_last_offset(offset_index_item_group_t* group);
+void offset_index_item_group_insert_items(offset_index_item_group_t* group, uint32_t pos, heap_offset_t const* insert, uint32_t count);
+heap_offset_t offset_index_item_group_remove_item(offset_index_item_group_t* group, uint32_t pos);
 void offset_index_item_group_remove_items(offset_index_item_group_t* group, uint32_t pos, uint32_t count);
-size_t offset_index_item_group_remove_last_offset(offset_index_item_group_t* group);
-void offset_index_item_group_remove_offset(offset_index_item_group_t* group, size_t offset);
+heap_offset_t offset_index_item_group_remove_last_offset(offset_index_item_group_t* group);
+void offset_index_item_group_remove_offset(offset_index_item_group_t* group, heap_offset_t offset);
 
 
 //===========================
@@ -212,27 +626,35 @@ void offset_index_item_group_remove_offset(offset_index_item_group_t* group, siz
 typedef struct
 {
 cluster_group_t header;
-size_t first_offset;
-size_t last_offset;
-offset_index_group_t* children[HEAP_GROUP_SIZE];
+heap_offset_t first_offset;
+heap_offset_t last_offset;
+heap_offset_t first_offsets[OFFSET_INDEX_PARENT_GROUP_SIZE];
+heap_offset_t last_offsets[OFFSET_INDEX_PARENT_GROUP_SIZE];
+offset_index_group_t* children[OFFSET_INDEX_PARENT_GROUP_SIZE];
 }offset_index_parent_group_t;
 
-bool offset_index_parent_group_add_offset(heap_t* heap, offset_index_parent_group_t* group, size_t offset, bool again);
-bool offset_index_parent_group_add_offset_internal(heap_t* heap, offset_index_parent_group_t* group, size_t offset, bool again);
-void offset_index_parent_group_append_groups(offset_index_parent_group_t* group, offset_index_group_t* const* append, uint32_t count);
+bool offset_index_parent_group_add_offset(heap_t* heap, offset_index_parent_group_t* group, heap_offset_t offset, bool again);
+bool offset_index_parent_group_add_offset_internal(heap_t* heap, offset_index_parent_group_t* group, heap_offset_t offset, bool again);
+void offset_index_parent_group_append_groups(offset_index_parent_group_t* group, offset_index_group_t* const* append, heap_offset_t const* first_offsets, heap_offset_t const* last_offsets, uint32_t count);
 bool offset_index_parent_group_combine_child(heap_t* heap, offset_index_parent_group_t* group, uint32_t pos);
 offset_index_parent_group_t* offset_index_parent_group_create(heap_t* heap, uint32_t level);
 offset_index_parent_group_t* offset_index_parent_group_create_with_child(heap_t* heap, offset_index_group_t* child);
-uint32_t offset_index_parent_group_get_item_pos(offset_index_parent_group_t* group, size_t offset, uint32_t* pos_ptr, bool must_exist);
-void offset_index_parent_group_insert_groups(offset_index_parent_group_t* group, uint32_t pos, offset_index_group_t* const* insert, uint32_t count);
+
+static inline uint32_t offset_index_parent_group_get_child_capacity(offset_index_parent_group_t* group)
+{
+return group->header.level>1? OFFSET_INDEX_PARENT_GROUP_SIZE: OFFSET_INDEX_ITEM_GROUP_SIZE;
+}
+uint32_t offset_index_parent_group_get_item_pos(offset_index_parent_group_t* group, heap_offset_t offset, uint32_t* pos_ptr, bool must_exist);
+void offset_index_parent_group_insert_groups(offset_index_parent_group_t* group, uint32_t pos, offset_index_group_t* const* insert, heap_offset_t const* first_offsets, heap_offset_t const* last_offsets, uint32_t count);
 void offset_index_parent_group_move_children(offset_index_parent_group_t* group, uint32_t from, uint32_t to, uint32_t count);
 void offset_index_parent_group_move_empty_slot(offset_index_parent_group_t* group, uint32_t from, uint32_t to);
 void offset_index_parent_group_remove_groups(offset_index_parent_group_t* group, uint32_t pos, uint32_t count);
-size_t offset_index_parent_group_remove_last_offset(heap_t* heap, offset_index_parent_group_t* group, bool passive);
-void offset_index_parent_group_remove_offset(heap_t* heap, offset_index_parent_group_t* group, size_t offset);
+heap_offset_t offset_index_parent_group_remove_last_offset(heap_t* heap, offset_index_parent_group_t* group, bool passive);
+void offset_index_parent_group_remove_offset(heap_t* heap, offset_index_parent_group_t* group, heap_offset_t offset);
 bool offset_index_parent_group_shift_children(offset_index_parent_group_t* group, uint32_t pos, uint32_t count);
 bool offset_index_parent_group_split_child(heap_t* heap, offset_index_parent_group_t* group, uint32_t pos);
 void offset_index_parent_group_update_bounds(offset_index_parent_group_t* group);
+void offset_index_parent_group_update_child(offset_index_parent_group_t* group, uint32_t pos);
 
 
 //==============
@@ -241,13 +663,26 @@ void offset_index_parent_group_update_bounds(offset_index_parent_group_t* group)
 
 typedef struct
 {
-offset_index_group_t* root;
+heap_offset_t root;
 }offset_index_t;
 
-bool offset_index_add_offset(heap_t* heap, offset_index_t* index, size_t offset);
-size_t offset_index_drop_root(heap_t* heap, offset_index_t* index);
+bool offset_index_add_offset(heap_t* heap, offset_index_t* index, heap_offset_t offset);
+heap_offset_t offset_index_drop_root(heap_t* heap, offset_index_t* index);
+
+static inline offset_index_group_t* offset_index_get_root(heap_t* heap, offset_index_t* index)
+{
+if(!index->root)
+	return nullptr;
+return (offset_index_group_t*)heap_get_absolute_offset(heap, index->root);
+}
+
 bool offset_index_lift_root(heap_t* heap, offset_index_t* index);
 
+static inline void offset_index_set_root(heap_t* heap, offset_index_t* index, offset_index_group_t* root)
+{
+index->root=root? heap_get_relative_offset(heap, (size_t)root): 0;
+}
+
 
 //================
 // Block-Map-Item
@@ -255,19 +690,43 @@ bool offset_index_lift_root(heap_t* heap, offset_index_t* index);
 
 typedef struct
 {
-size_t size;
+heap_offset_t size;
 union
 	{
 	struct
 		{
-		size_t offset: SIZE_BITS-1;
-		size_t single: 1;
+		heap_offset_t offset: OFFSET_BITS-1;
+		heap_offset_t single: 1;
 		};
 	offset_index_t index;
 	};
 }block_map_item_t;
 
 
+//============
+// Block-List
+//============
+
+static inline heap_offset_t* block_list_get_links(heap_t* heap, heap_offset_t offset)
+{
+return (heap_offset_t*)(heap_get_absolute_offset(heap, offset)+sizeof(size_t));
+}
+
+void block_list_insert(heap_t* heap, block_map_item_t* item, heap_offset_t offset);
+
+static inline bool block_list_is_listed(size_t size)
+{
+#if HEAP_BLOCK_LISTS
+return size>=2*sizeof(size_t)+2*sizeof(heap_offset_t);
+#else
+return false;
+#endif
+}
+
+heap_offset_t block_list_pop(heap_t* heap, block_map_item_t* item);
+void block_list_remove(heap_t* heap, block_map_item_t* item, heap_offset_t offset);
+
+
 //=================
 // Block-Map-Group
 //=================
@@ -275,6 +734,7 @@ union
 typedef cluster_group_t block_map_group_t;
 
 int16_t block_map_group_add_block(heap_t* heap, block_map_group_t* group, heap_block_info_t const* info, bool again);
+size_t block_map_group_find_size(block_map_group_t* group, size_t min_size);
 bool block_map_group_get_block(heap_t* heap, block_map_group_t* group, size_t min_size, heap_block_info_t* info);
 size_t block_map_group_get_first_size(block_map_group_t* group);
 size_t block_map_group_get_last_size(block_map_group_t* group);
@@ -288,21 +748,22 @@ void block_map_group_remove_block(heap_t* heap, block_map_group_t* group, heap_b
 typedef struct
 {
 cluster_group_t header;
-block_map_item_t items[HEAP_GROUP_SIZE];
+block_map_item_t items[BLOCK_MAP_ITEM_GROUP_SIZE];
 }block_map_item_group_t;
 
 int16_t block_map_item_group_add_block(heap_t* heap, block_map_item_group_t* group, heap_block_info_t const* info);
-bool block_map_item_group_add_item(block_map_item_group_t* group, heap_block_info_t const* info, uint32_t pos);
+bool block_map_item_group_add_item(heap_t* heap, block_map_item_group_t* group, heap_block_info_t const* info, uint32_t pos);
 void block_map_item_group_append_items(block_map_item_group_t* group, block_map_item_t const* items, uint32_t count);
 void block_map_item_group_cleanup(heap_t* heap, block_map_item_group_t* group, size_t ignore);
 block_map_item_group_t* block_map_item_group_create(heap_t* heap);
+size_t block_map_item_group_find_size(block_map_item_group_t* group, size_t min_size);
 bool block_map_item_group_get_block(heap_t* heap, block_map_item_group_t* group, size_t min_size, heap_block_info_t* info, bool passive);
 size_t block_map_item_group_get_first_size(block_map_item_group_t* group);
 uint32_t block_map_item_group_get_item_pos(block_map_item_group_t* group, size_t size, bool* exists_ptr);
 size_t block_map_item_group_get_last_size(block_map_item_group_t* group);
 void block_map_item_group_insert_items(block_map_item_group_t* group, uint32_t pos, block_map_item_t const* items, uint32_t count);
 void block_map_item_group_remove_block(heap_t* heap, block_map_item_group_t* group, heap_block_info_t const* info);
-size_t block_map_item_group_remove_item_at(block_map_item_group_t* group, uint32_t pos, bool passive);
+heap_offset_t block_map_item_group_remove_item_at(block_map_item_group_t* group, uint32_t pos, bool passive);
 void block_map_item_group_remove_items(block_map_item_group_t* group, uint32_t pos, uint32_t count);
 
 
@@ -313,20 +774,28 @@ void block_map_item_group_remove_items(block_map_item_group_t* group, uint32_t p
 typedef struct
 {
 cluster_group_t header;
-size_t first_size;
-size_t last_size;
-block_map_group_t* children[HEAP_GROUP_SIZE];
+heap_offset_t first_size;
+heap_offset_t last_size;
+heap_offset_t first_sizes[BLOCK_MAP_PARENT_GROUP_SIZE];
+heap_offset_t last_sizes[BLOCK_MAP_PARENT_GROUP_SIZE];
+block_map_group_t* children[BLOCK_MAP_PARENT_GROUP_SIZE];
 }block_map_parent_group_t;
 
 int16_t block_map_parent_group_add_block(heap_t* heap, block_map_parent_group_t* group, heap_block_info_t const* info, bool again);
 int16_t block_map_parent_group_add_block_internal(heap_t* heap, block_map_parent_group_t* group, heap_block_info_t const* info, bool again);
-void block_map_parent_group_append_groups(block_map_parent_group_t* group, block_map_group_t* const* append, uint32_t count);
+void block_map_parent_group_append_groups(block_map_parent_group_t* group, block_map_group_t* const* append, heap_offset_t const* first_sizes, heap_offset_t const* last_sizes, uint32_t count);
 bool block_map_parent_group_combine_child(heap_t* heap, block_map_parent_group_t* group, uint32_t pos);
 block_map_parent_group_t* block_map_parent_group_create(heap_t* heap, uint32_t level);
 block_map_parent_group_t* block_map_parent_group_create_with_child(heap_t* heap, block_map_group_t* child);
+size_t block_map_parent_group_find_size(block_map_parent_group_t* group, size_t min_size);
 bool block_map_parent_group_get_block(heap_t* heap, block_map_parent_group_t* group, size_t min_size, heap_block_info_t* info, bool passive);
+
+static inline uint32_t block_map_parent_group_get_child_capacity(block_map_parent_group_t* group)
+{
+return group->header.level>1? BLOCK_MAP_PARENT_GROUP_SIZE: BLOCK_MAP_ITEM_GROUP_SIZE;
+}
 uint32_t block_map_parent_group_get_item_pos(block_map_parent_group_t* group, size_t size, uint32_t* pos_ptr, bool must_exist);
-void block_map_parent_group_insert_groups(block_map_parent_group_t* group, uint32_t pos, block_map_group_t* const* insert, uint32_t count);
+void block_map_parent_group_insert_groups(block_map_parent_group_t* group, uint32_t pos, block_map_group_t* const* insert, heap_offset_t const* first_sizes, heap_offset_t const* last_sizes, uint32_t count);
 void block_map_parent_group_move_children(block_map_parent_group_t* group, uint32_t from, uint32_t to, uint32_t count);
 void block_map_parent_group_move_empty_slot(block_map_parent_group_t* group, uint32_t from, uint32_t to);
 void block_map_parent_group_remove_block(heap_t* heap, block_map_parent_group_t* group, heap_block_info_t const* info);
@@ -334,6 +803,7 @@ void block_map_parent_group_remove_groups(block_map_parent_group_t* group, uint3
 bool block_map_parent_group_shift_children(block_map_parent_group_t* group, uint32_t pos, uint32_t count);
 bool block_map_parent_group_split_child(heap_t* heap, block_map_parent_group_t* group, uint32_t pos);
 void block_map_parent_group_update_bounds(block_map_parent_group_t* group);
+void block_map_parent_group_update_child(block_map_parent_group_t* group, uint32_t pos);
 
 
 //===========
@@ -343,15 +813,23 @@ void block_map_parent_group_update_bounds(block_map_parent_group_t* group);
 typedef struct
 {
 block_map_group_t* root;
+size_t classes;
+size_t count;
 }block_map_t;
 
 bool block_map_add_block(heap_t* heap, block_map_t* map, heap_block_info_t const* info);
+void block_map_add_class(block_map_t* map, size_t size);
 bool block_map_drop_root(heap_t* heap, block_map_t* map);
 bool block_map_get_block(heap_t* heap, block_map_t* map, size_t min_size, heap_block_info_t* info);
 
+static inline uint32_t block_map_get_class(size_t size)
+{
+return (uint32_t)(63-__builtin_clzll((unsigned long long)size));
+}
+
 static inline size_t block_map_get_last_size(block_map_t* map)
 {
-if(!map->root)
+if(!map->classes)
 	return 0;
 return block_map_group_get_last_size(map->root);
 }
@@ -359,10 +837,13 @@ return block_map_group_get_last_size(map->root);
 static inline void block_map_init(block_map_t* map)
 {
 map->root=nullptr;
+map->classes=0;
+map->count=0;
 }
 
 bool block_map_lift_root(heap_t* heap, block_map_t* map);
 void block_map_remove_block(heap_t* heap, block_map_t* map, heap_block_info_t const* info);
+void block_map_remove_class(block_map_t* map, size_t size);
 
 
 #ifdef __cplusplus
@@ -0,0 +1,193 @@
+//==============
+// heap_epoch.c
+//==============
+
+// Epoch-based reclamation of heap blocks for lock-free structures
+
+// Copyright 2026, Sven Bieg (svenbieg@outlook.de)
+// http://github.com/svenbieg/Heap
+
+
+//=======
+// Using
+//=======
+
+#include <assert.h>
+#include <string.h>
+#include "heap_epoch.h"
+
+
+//============
+// Heap-Epoch
+//============
+
+bool heap_epoch_advance(heap_epoch_t* epoch)
+{
+size_t global=__atomic_load_n(&epoch->global, __ATOMIC_SEQ_CST);
+for(uint32_t u=0; u<HEAP_EPOCH_THREADS; u++)
+	{
+	heap_epoch_thread_t* thread=&epoch->threads[u];
+	if(!__atomic_load_n(&thread->registered, __ATOMIC_ACQUIRE))
+		continue;
+	size_t local=__atomic_load_n(&thread->epoch, __ATOMIC_ACQUIRE);
+	if((local&1)&&(local>>1)!=global)
+		return false;
+	}
+return __atomic_compare_exchange_n(&epoch->global, &global, global+1, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+void heap_epoch_collect(heap_epoch_t* epoch, uint32_t thread)
+{
+heap_epoch_thread_t* current=&epoch->threads[thread];
+size_t global=__atomic_load_n(&epoch->global, __ATOMIC_ACQUIRE);
+for(uint32_t pos=0; pos<3; pos++)
+	{
+	if(current->batches[pos]&&current->batch_epochs[pos]+2<=global)
+		heap_epoch_reclaim(epoch, current, pos);
+	}
+if(__atomic_load_n(&epoch->orphans, __ATOMIC_RELAXED))
+	heap_epoch_collect_orphans(epoch, global);
+}
+
+void heap_epoch_collect_orphans(heap_epoch_t* epoch, size_t global)
+{
+while(__atomic_exchange_n(&epoch->lock, 1, __ATOMIC_ACQUIRE));
+size_t* batch_ptr=&epoch->orphans;
+while(true)
+	{
+	heap_epoch_batch_t* batch=(heap_epoch_batch_t*)__atomic_load_n(batch_ptr, __ATOMIC_RELAXED);
+	if(!batch)
+		break;
+	if(batch->epoch+2>global)
+		{
+		batch_ptr=&batch->next;
+		continue;
+		}
+	__atomic_store_n(batch_ptr, batch->next, __ATOMIC_RELAXED);
+	heap_epoch_free_batch(epoch, batch);
+	}
+__atomic_store_n(&epoch->lock, 0, __ATOMIC_RELEASE);
+}
+
+heap_epoch_t* heap_epoch_create(heap_t* heap)
+{
+assert(heap!=nullptr);
+heap_epoch_t* epoch=(heap_epoch_t*)heap_alloc_ex(heap, sizeof(heap_epoch_t), HEAP_ALLOC_CACHE_LINE);
+if(!epoch)
+	return nullptr;
+memset(epoch, 0, sizeof(heap_epoch_t));
+epoch->heap=heap;
+return epoch;
+}
+
+void heap_epoch_destroy(heap_epoch_t* epoch)
+{
+if(!epoch)
+	return;
+for(uint32_t u=0; u<HEAP_EPOCH_THREADS; u++)
+	{
+	heap_epoch_thread_t* thread=&epoch->threads[u];
+	for(uint32_t pos=0; pos<3; pos++)
+		heap_epoch_reclaim(epoch, thread, pos);
+	}
+heap_epoch_collect_orphans(epoch, SIZE_MAX);
+heap_free(epoch->heap, epoch);
+}
+
+void heap_epoch_enter(heap_epoch_t* epoch, uint32_t thread)
+{
+size_t global=__atomic_load_n(&epoch->global, __ATOMIC_ACQUIRE);
+__atomic_store_n(&epoch->threads[thread].epoch, (global<<1)|1, __ATOMIC_SEQ_CST);
+}
+
+void heap_epoch_exit(heap_epoch_t* epoch, uint32_t thread)
+{
+__atomic_store_n(&epoch->threads[thread].epoch, 0, __ATOMIC_RELEASE);
+}
+
+void heap_epoch_free_batch(heap_epoch_t* epoch, heap_epoch_batch_t* batch)
+{
+batch->items[batch->count++]=batch;
+heap_free_batch(epoch->heap, batch->items, batch->count);
+}
+
+void heap_epoch_reclaim(heap_epoch_t* epoch, heap_epoch_thread_t* thread, uint32_t pos)
+{
+heap_epoch_batch_t* batch=(heap_epoch_batch_t*)thread->batches[pos];
+thread->batches[pos]=0;
+while(batch)
+	{
+	heap_epoch_batch_t* next=(heap_epoch_batch_t*)batch->next;
+	heap_epoch_free_batch(epoch, batch);
+	batch=next;
+	}
+}
+
+int32_t heap_epoch_register(heap_epoch_t* epoch)
+{
+assert(epoch!=nullptr);
+for(uint32_t u=0; u<HEAP_EPOCH_THREADS; u++)
+	{
+	heap_epoch_thread_t* thread=&epoch->threads[u];
+	size_t registered=0;
+	if(__atomic_compare_exchange_n(&thread->registered, &registered, 1, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+		return (int32_t)u;
+	}
+return -1;
+}
+
+void heap_epoch_unregister(heap_epoch_t* epoch, uint32_t thread)
+{
+heap_epoch_thread_t* current=&epoch->threads[thread];
+heap_epoch_exit(epoch, thread);
+heap_epoch_collect(epoch, thread);
+while(__atomic_exchange_n(&epoch->lock, 1, __ATOMIC_ACQUIRE));
+for(uint32_t pos=0; pos<3; pos++)
+	{
+	heap_epoch_batch_t* batch=(heap_epoch_batch_t*)current->batches[pos];
+	current->batches[pos]=0;
+	while(batch)
+		{
+		heap_epoch_batch_t* next=(heap_epoch_batch_t*)batch->next;
+		batch->epoch=current->batch_epochs[pos];
+		batch->next=__atomic_load_n(&epoch->orphans, __ATOMIC_RELAXED);
+		__atomic_store_n(&epoch->orphans, (size_t)batch, __ATOMIC_RELAXED);
+		batch=next;
+		}
+	}
+__atomic_store_n(&epoch->lock, 0, __ATOMIC_RELEASE);
+__atomic_store_n(&current->registered, 0, __ATOMIC_RELEASE);
+}
+
+bool heap_retire(heap_epoch_t* epoch, uint32_t thread, void* buf)
+{
+assert(epoch!=nullptr);
+if(!buf)
+	return true;
+heap_epoch_thread_t* current=&epoch->threads[thread];
+size_t global=__atomic_load_n(&epoch->global, __ATOMIC_ACQUIRE);
+uint32_t pos=global%3;
+if(current->batch_epochs[pos]!=global)
+	{
+	heap_epoch_reclaim(epoch, current, pos);
+	current->batch_epochs[pos]=global;
+	}
+heap_epoch_batch_t* batch=(heap_epoch_batch_t*)current->batches[pos];
+if(!batch||batch->count==HEAP_EPOCH_BATCH)
+	{
+	heap_epoch_batch_t* next=(heap_epoch_batch_t*)heap_alloc(epoch->heap, sizeof(heap_epoch_batch_t));
+	if(!next)
+		return false;
+	next->next=(size_t)batch;
+	next->count=0;
+	current->batches[pos]=(size_t)next;
+	batch=next;
+	}
+batch->items[batch->count++]=buf;
+if(batch->count==HEAP_EPOCH_BATCH)
+	{
+	heap_epoch_advance(epoch);
+	heap_epoch_collect(epoch, thread);
+	}
+return true;
+}
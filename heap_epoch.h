@@ -0,0 +1,91 @@
+//==============
+// heap_epoch.h
+//==============
+
+// Epoch-based reclamation of heap blocks for lock-free structures
+
+// Copyright 2026, Sven Bieg (svenbieg@outlook.de)
+// http://github.com/svenbieg/Heap
+
+#pragma once
+
+
+//=======
+// Using
+//=======
+
+#include "heap.h"
+
+#if !HEAP_THREADSAFE
+#error "heap_epoch requires HEAP_THREADSAFE"
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+//==========
+// Settings
+//==========
+
+#define HEAP_EPOCH_BATCH 60
+#define HEAP_EPOCH_THREADS 64
+
+
+//==================
+// Heap-Epoch-Batch
+//==================
+
+typedef struct
+{
+size_t next;
+size_t count;
+size_t epoch;
+void* items[HEAP_EPOCH_BATCH+1];
+}heap_epoch_batch_t;
+
+
+//===================
+// Heap-Epoch-Thread
+//===================
+
+typedef struct
+{
+size_t epoch;
+size_t registered;
+size_t batches[3];
+size_t batch_epochs[3];
+}__attribute__((aligned(HEAP_CACHE_LINE))) heap_epoch_thread_t;
+
+
+//============
+// Heap-Epoch
+//============
+
+typedef struct
+{
+heap_t* heap;
+size_t global;
+size_t lock;
+size_t orphans;
+heap_epoch_thread_t threads[HEAP_EPOCH_THREADS];
+}heap_epoch_t;
+
+bool heap_epoch_advance(heap_epoch_t* epoch);
+void heap_epoch_collect(heap_epoch_t* epoch, uint32_t thread);
+void heap_epoch_collect_orphans(heap_epoch_t* epoch, size_t global);
+heap_epoch_t* heap_epoch_create(heap_t* heap);
+void heap_epoch_destroy(heap_epoch_t* epoch);
+void heap_epoch_enter(heap_epoch_t* epoch, uint32_t thread);
+void heap_epoch_exit(heap_epoch_t* epoch, uint32_t thread);
+void heap_epoch_free_batch(heap_epoch_t* epoch, heap_epoch_batch_t* batch);
+void heap_epoch_reclaim(heap_epoch_t* epoch, heap_epoch_thread_t* thread, uint32_t pos);
+int32_t heap_epoch_register(heap_epoch_t* epoch);
+void heap_epoch_unregister(heap_epoch_t* epoch, uint32_t thread);
+bool heap_retire(heap_epoch_t* epoch, uint32_t thread, void* buf);
+
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,287 @@
+//=============
+// heap_pool.h
+//=============
+
+// Typed fixed-size object-pool on top of heap_t
+
+// Copyright 2026, Sven Bieg (svenbieg@outlook.de)
+// http://github.com/svenbieg/Heap
+
+#pragma once
+
+
+//=======
+// Using
+//=======
+
+#include <atomic>
+#include <new>
+#include <utility>
+#include "heap.h"
+
+
+//===========
+// Heap-Pool
+//===========
+
+template <class _item_t, size_t _slab_count=64>
+class heap_pool
+{
+public:
+	// Con-/Destructors
+	heap_pool(heap_t* heap): m_Empty(nullptr), m_Full(nullptr), m_Heap(heap), m_Partial(nullptr)
+		{
+		m_Lock.clear();
+		}
+	heap_pool(heap_pool const&)=delete;
+	~heap_pool()
+		{
+		free_slabs(m_Full);
+		free_slabs(m_Partial);
+		if(m_Empty)
+			heap_free(m_Heap, m_Empty);
+		}
+
+	// Modification
+	void* alloc()
+		{
+		lock();
+		slab_t* slab=m_Partial;
+		if(!slab)
+			{
+			slab=create_slab();
+			if(!slab)
+				{
+				unlock();
+				return nullptr;
+				}
+			link_slab(m_Partial, slab);
+			}
+		slot_t* slot=slab->free;
+		if(slot)
+			{
+			slab->free=slot->next;
+			}
+		else
+			{
+			slot=&slab->slots[slab->bump++];
+			slot->slab=slab;
+			}
+		if(++slab->used==_slab_count)
+			{
+			unlink_slab(m_Partial, slab);
+			link_slab(m_Full, slab);
+			}
+		unlock();
+		return slot->value;
+		}
+	template <class... _args_t> _item_t* construct(_args_t&&... args)
+		{
+		void* buf=alloc();
+		if(!buf)
+			return nullptr;
+		return new (buf) _item_t(std::forward<_args_t>(args)...);
+		}
+	void destroy(_item_t* item)
+		{
+		if(!item)
+			return;
+		item->~_item_t();
+		free(item);
+		}
+	void free(void* buf)
+		{
+		if(!buf)
+			return;
+		slot_t* slot=get_slot(buf);
+		slab_t* slab=slot->slab;
+		lock();
+		slot->next=slab->free;
+		slab->free=slot;
+		if(slab->used--==_slab_count)
+			{
+			unlink_slab(m_Full, slab);
+			link_slab(m_Partial, slab);
+			}
+		if(slab->used==0)
+			release_slab(slab);
+		unlock();
+		}
+	heap_pool& operator=(heap_pool const&)=delete;
+
+private:
+	// Slot
+	struct slab_t;
+	struct slot_t
+		{
+		slab_t* slab;
+		union
+			{
+			slot_t* next;
+			alignas(_item_t) unsigned char value[sizeof(_item_t)];
+			};
+		};
+
+	// Slab
+	struct slab_t
+		{
+		slab_t* previous;
+		slab_t* next;
+		slot_t* free;
+		size_t used;
+		size_t bump;
+		slot_t slots[_slab_count];
+		};
+
+	// Common
+	slab_t* create_slab()
+		{
+		slab_t* slab=m_Empty;
+		m_Empty=nullptr;
+		if(!slab)
+			{
+			if(alignof(slab_t)>sizeof(size_t))
+				{
+				slab=(slab_t*)heap_alloc_aligned(m_Heap, sizeof(slab_t), alignof(slab_t));
+				}
+			else
+				{
+				slab=(slab_t*)heap_alloc(m_Heap, sizeof(slab_t));
+				}
+			if(!slab)
+				return nullptr;
+			}
+		slab->previous=nullptr;
+		slab->next=nullptr;
+		slab->free=nullptr;
+		slab->used=0;
+		slab->bump=0;
+		return slab;
+		}
+	void free_slabs(slab_t* slab)
+		{
+		while(slab)
+			{
+			slab_t* next=slab->next;
+			heap_free(m_Heap, slab);
+			slab=next;
+			}
+		}
+	static slot_t* get_slot(void* buf)
+		{
+		return (slot_t*)((size_t)buf-offsetof(slot_t, value));
+		}
+	void link_slab(slab_t*& list, slab_t* slab)
+		{
+		slab->previous=nullptr;
+		slab->next=list;
+		if(list)
+			list->previous=slab;
+		list=slab;
+		}
+	void lock()
+		{
+		while(m_Lock.test_and_set(std::memory_order_acquire));
+		}
+	void release_slab(slab_t* slab)
+		{
+		unlink_slab(m_Partial, slab);
+		if(!m_Empty)
+			{
+			m_Empty=slab;
+			return;
+			}
+		heap_free(m_Heap, slab);
+		}
+	void unlink_slab(slab_t*& list, slab_t* slab)
+		{
+		if(slab->previous)
+			{
+			slab->previous->next=slab->next;
+			}
+		else
+			{
+			list=slab->next;
+			}
+		if(slab->next)
+			slab->next->previous=slab->previous;
+		}
+	void unlock()
+		{
+		m_Lock.clear(std::memory_order_release);
+		}
+	slab_t* m_Empty;
+	slab_t* m_Full;
+	heap_t* m_Heap;
+	std::atomic_flag m_Lock;
+	slab_t* m_Partial;
+};
+
+
+//====================
+// Heap-Pool-Magazine
+//====================
+
+template <class _item_t, size_t _slab_count=64, size_t _size=32>
+class heap_pool_magazine
+{
+public:
+	// Con-/Destructors
+	heap_pool_magazine(heap_pool<_item_t, _slab_count>& pool): m_Count(0), m_Pool(pool) {}
+	heap_pool_magazine(heap_pool_magazine const&)=delete;
+	~heap_pool_magazine()
+		{
+		while(m_Count)
+			m_Pool.free(m_Items[--m_Count]);
+		}
+
+	// Modification
+	void* alloc()
+		{
+		if(!m_Count)
+			{
+			while(m_Count<_size/2)
+				{
+				void* buf=m_Pool.alloc();
+				if(!buf)
+					break;
+				m_Items[m_Count++]=buf;
+				}
+			if(!m_Count)
+				return nullptr;
+			}
+		return m_Items[--m_Count];
+		}
+	template <class... _args_t> _item_t* construct(_args_t&&... args)
+		{
+		void* buf=alloc();
+		if(!buf)
+			return nullptr;
+		return new (buf) _item_t(std::forward<_args_t>(args)...);
+		}
+	void destroy(_item_t* item)
+		{
+		if(!item)
+			return;
+		item->~_item_t();
+		free(item);
+		}
+	void free(void* buf)
+		{
+		if(!buf)
+			return;
+		if(m_Count==_size)
+			{
+			while(m_Count>_size/2)
+				m_Pool.free(m_Items[--m_Count]);
+			}
+		m_Items[m_Count++]=buf;
+		}
+	heap_pool_magazine& operator=(heap_pool_magazine const&)=delete;
+
+private:
+	// Common
+	size_t m_Count;
+	void* m_Items[_size];
+	heap_pool<_item_t, _slab_count>& m_Pool;
+};
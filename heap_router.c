@@ -0,0 +1,106 @@
+//===============
+// heap_router.c
+//===============
+
+// Routes allocations to size-segregated heaps
+
+// Copyright 2026, Sven Bieg (svenbieg@outlook.de)
+// http://github.com/svenbieg/Heap
+
+
+//=======
+// Using
+//=======
+
+#include <assert.h>
+#include "heap_router.h"
+
+
+//=============
+// Heap-Router
+//=============
+
+void* heap_router_alloc(heap_router_t* router, size_t size)
+{
+assert(router!=nullptr);
+assert(size!=0);
+uint32_t band=heap_router_get_band(router, size);
+void* buf=heap_alloc(router->heaps[band], size);
+if(buf)
+	return buf;
+#if HEAP_LARGE_THRESHOLD
+if(size>=HEAP_LARGE_THRESHOLD)
+	return nullptr;
+#endif
+for(uint32_t u=1; u<router->count; u++)
+	{
+	uint32_t steal=(band+u)%router->count;
+	buf=heap_alloc(router->heaps[steal], size);
+	if(buf)
+		return buf;
+	}
+return nullptr;
+}
+
+bool heap_router_create(heap_router_t* router, size_t offset, size_t size, size_t const* limits, size_t const* sizes, uint32_t count)
+{
+assert(router!=nullptr);
+assert(count>0&&count<=HEAP_ROUTER_BANDS_MAX);
+offset=align_up(offset, sizeof(size_t));
+size=align_down(size, sizeof(size_t));
+size_t granule=align_up(size/HEAP_ROUTER_GRANULES, sizeof(size_t));
+router->count=count;
+router->start=offset;
+router->end=offset+size;
+router->granule=granule;
+size_t heap_offset=offset;
+for(uint32_t band=0; band<count; band++)
+	{
+	size_t heap_size=router->end-heap_offset;
+	if(band+1<count)
+		heap_size=align_up(sizes[band], granule);
+	if(heap_size<=sizeof(heap_t)||heap_offset+heap_size>router->end)
+		return false;
+	router->heaps[band]=heap_create(heap_offset, heap_size);
+	router->limits[band]=limits[band];
+	size_t first=(heap_offset-offset)/granule;
+	size_t last=(heap_offset+heap_size-offset+granule-1)/granule;
+	for(size_t u=first; u<last&&u<HEAP_ROUTER_GRANULES; u++)
+		router->owners[u]=(uint8_t)band;
+	heap_offset+=heap_size;
+	}
+return true;
+}
+
+void heap_router_free(heap_router_t* router, void* buf)
+{
+assert(router!=nullptr);
+if(!buf)
+	return;
+heap_free(heap_router_get_heap(router, buf), buf);
+}
+
+uint32_t heap_router_get_band(heap_router_t* router, size_t size)
+{
+#if HEAP_LARGE_THRESHOLD
+if(size>=HEAP_LARGE_THRESHOLD)
+	return router->count-1;
+#endif
+for(uint32_t band=0; band+1<router->count; band++)
+	{
+	if(size<=router->limits[band])
+		return band;
+	}
+return router->count-1;
+}
+
+heap_t* heap_router_get_heap(heap_router_t* router, void const* buf)
+{
+size_t offset=(size_t)buf;
+if(offset<router->start||offset>=router->end)
+	return router->heaps[router->count-1];
+size_t granule=(offset-router->start)/router->granule;
+if(granule>=HEAP_ROUTER_GRANULES)
+	granule=HEAP_ROUTER_GRANULES-1;
+return router->heaps[router->owners[granule]];
+}
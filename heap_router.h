@@ -0,0 +1,56 @@
+//===============
+// heap_router.h
+//===============
+
+// Routes allocations to size-segregated heaps
+
+// Copyright 2026, Sven Bieg (svenbieg@outlook.de)
+// http://github.com/svenbieg/Heap
+
+#pragma once
+
+
+//=======
+// Using
+//=======
+
+#include "heap.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+//==========
+// Settings
+//==========
+
+#define HEAP_ROUTER_BANDS_MAX 8
+#define HEAP_ROUTER_GRANULES 256
+
+
+//=============
+// Heap-Router
+//=============
+
+typedef struct
+{
+heap_t* heaps[HEAP_ROUTER_BANDS_MAX];
+size_t limits[HEAP_ROUTER_BANDS_MAX];
+uint32_t count;
+size_t start;
+size_t end;
+size_t granule;
+uint8_t owners[HEAP_ROUTER_GRANULES];
+}heap_router_t;
+
+void* heap_router_alloc(heap_router_t* router, size_t size);
+bool heap_router_create(heap_router_t* router, size_t offset, size_t size, size_t const* limits, size_t const* sizes, uint32_t count);
+void heap_router_free(heap_router_t* router, void* buf);
+uint32_t heap_router_get_band(heap_router_t* router, size_t size);
+heap_t* heap_router_get_heap(heap_router_t* router, void const* buf);
+
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
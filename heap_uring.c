@@ -0,0 +1,103 @@
+//==============
+// heap_uring.c
+//==============
+
+// Registers heap memory as io_uring fixed buffers
+
+// Copyright 2026, Sven Bieg (svenbieg@outlook.de)
+// http://github.com/svenbieg/Heap
+
+
+//=======
+// Using
+//=======
+
+#include <assert.h>
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "heap_uring.h"
+
+
+//============
+// Heap-Uring
+//============
+
+void* heap_uring_alloc(heap_uring_t* uring, size_t size)
+{
+assert(uring!=nullptr);
+assert(size!=0);
+void* buf=heap_alloc_aligned(uring->heap, size, HEAP_PAGE_SIZE);
+if(!buf)
+	return nullptr;
+if(heap_uring_get_index(uring, buf, size)<0)
+	{
+	heap_free(uring->heap, buf);
+	return nullptr;
+	}
+return buf;
+}
+
+void heap_uring_free(heap_uring_t* uring, void* buf)
+{
+assert(uring!=nullptr);
+heap_free(uring->heap, buf);
+}
+
+int heap_uring_get_index(heap_uring_t* uring, void const* buf, size_t size)
+{
+size_t offset=(size_t)buf;
+if(offset<uring->start||offset+size>uring->end)
+	return -1;
+size_t first=(offset-uring->start)/uring->slice_size;
+size_t last=(offset+size-1-uring->start)/uring->slice_size;
+if(first!=last)
+	return -1;
+return (int)first;
+}
+
+bool heap_uring_register(heap_uring_t* uring, heap_t* heap, int ring_fd, size_t offset, size_t size)
+{
+assert(uring!=nullptr);
+assert(heap!=nullptr);
+if(!size)
+	{
+	offset=(size_t)heap;
+	size=heap->size;
+	}
+assert(offset>=(size_t)heap);
+assert(offset+size<=(size_t)heap+heap->size);
+size_t count=(size+HEAP_URING_SLICE_MAX-1)/HEAP_URING_SLICE_MAX;
+if(count>HEAP_URING_SLICES_MAX)
+	return false;
+size_t slice_size=align_up((size+count-1)/count, HEAP_PAGE_SIZE);
+struct iovec iovs[HEAP_URING_SLICES_MAX];
+for(size_t u=0; u<count; u++)
+	{
+	size_t slice_start=offset+u*slice_size;
+	size_t slice_end=slice_start+slice_size;
+	if(slice_end>offset+size)
+		slice_end=offset+size;
+	iovs[u].iov_base=(void*)slice_start;
+	iovs[u].iov_len=slice_end-slice_start;
+	}
+if(syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_BUFFERS, iovs, (unsigned int)count)<0)
+	return false;
+uring->heap=heap;
+uring->ring_fd=ring_fd;
+uring->start=offset;
+uring->end=offset+size;
+uring->slice_size=slice_size;
+uring->slice_count=(uint32_t)count;
+return true;
+}
+
+void heap_uring_unregister(heap_uring_t* uring)
+{
+assert(uring!=nullptr);
+syscall(__NR_io_uring_register, uring->ring_fd, IORING_UNREGISTER_BUFFERS, nullptr, 0);
+uring->slice_count=0;
+uring->start=0;
+uring->end=0;
+}
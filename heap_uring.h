@@ -0,0 +1,55 @@
+//==============
+// heap_uring.h
+//==============
+
+// Registers heap memory as io_uring fixed buffers
+
+// Copyright 2026, Sven Bieg (svenbieg@outlook.de)
+// http://github.com/svenbieg/Heap
+
+#pragma once
+
+
+//=======
+// Using
+//=======
+
+#include "heap.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+//==========
+// Settings
+//==========
+
+#define HEAP_URING_SLICE_MAX ((size_t)1<<30)
+#define HEAP_URING_SLICES_MAX 1024
+
+
+//============
+// Heap-Uring
+//============
+
+typedef struct
+{
+heap_t* heap;
+int ring_fd;
+size_t start;
+size_t end;
+size_t slice_size;
+uint32_t slice_count;
+}heap_uring_t;
+
+void* heap_uring_alloc(heap_uring_t* uring, size_t size);
+void heap_uring_free(heap_uring_t* uring, void* buf);
+int heap_uring_get_index(heap_uring_t* uring, void const* buf, size_t size);
+bool heap_uring_register(heap_uring_t* uring, heap_t* heap, int ring_fd, size_t offset, size_t size);
+void heap_uring_unregister(heap_uring_t* uring);
+
+
+#ifdef __cplusplus
+} // extern "C"
+#endif